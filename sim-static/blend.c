@@ -0,0 +1,316 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "draw.h"
+
+/*
+ * Row blending kernels. The result must be the same as alphacolor ():
+ * per channel, min (255, (a * C + (256 - a) * B + 3 * B) >> 8), where
+ * C is the color and B is the base. With 16-bit lanes every product
+ * fits, and saturating the two sums clamps exactly where BYTEBOUND
+ * would. Alpha 255 replaces the base and alpha 0 keeps it, as
+ * pset_abs does.
+ */
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#  define BLEND_X86
+#  include <immintrin.h>
+#endif
+
+static void
+blend_span_color_generic (Uint32 *dst, int n, Uint32 color)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = alphacolor (NULL, dst[i], color);
+}
+
+static void
+blend_span_pixels_generic (Uint32 *dst, const Uint32 *src, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (G_ALPHA (src[i]))
+      dst[i] = alphacolor (NULL, dst[i], src[i]);
+}
+
+#ifdef BLEND_X86
+__attribute__ ((target ("sse2"))) static void
+blend_span_color_sse2 (Uint32 *dst, int n, Uint32 color)
+{
+  int i;
+  int a = G_ALPHA (color);
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i mask = _mm_set1_epi32 (COLOR_MASK);
+  __m128i k    = _mm_set1_epi16 (256 - a);
+  __m128i ac   = _mm_set_epi16 (
+    0, a * G_RED (color), a * G_GREEN (color), a * G_BLUE (color),
+    0, a * G_RED (color), a * G_GREEN (color), a * G_BLUE (color));
+  __m128i d, lo, hi;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    d  = _mm_loadu_si128 ((const __m128i *) (dst + i));
+    lo = _mm_unpacklo_epi8 (d, zero);
+    hi = _mm_unpackhi_epi8 (d, zero);
+
+    lo = _mm_adds_epu16 (
+      _mm_adds_epu16 (ac, _mm_mullo_epi16 (lo, k)),
+      _mm_add_epi16 (_mm_slli_epi16 (lo, 1), lo));
+    hi = _mm_adds_epu16 (
+      _mm_adds_epu16 (ac, _mm_mullo_epi16 (hi, k)),
+      _mm_add_epi16 (_mm_slli_epi16 (hi, 1), hi));
+
+    d = _mm_packus_epi16 (_mm_srli_epi16 (lo, 8), _mm_srli_epi16 (hi, 8));
+
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_and_si128 (d, mask));
+  }
+
+  blend_span_color_generic (dst + i, n - i, color);
+}
+
+/* Blend 8 channels of a source and a base, alpha taken from the source */
+__attribute__ ((target ("sse2"))) static inline __m128i
+blend_lanes_sse2 (__m128i s, __m128i d)
+{
+  __m128i a;
+
+  a = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (s, 0xff), 0xff);
+
+  return _mm_srli_epi16 (
+    _mm_adds_epu16 (
+      _mm_adds_epu16 (
+        _mm_mullo_epi16 (a, s),
+        _mm_mullo_epi16 (_mm_sub_epi16 (_mm_set1_epi16 (256), a), d)),
+      _mm_add_epi16 (_mm_slli_epi16 (d, 1), d)),
+    8);
+}
+
+__attribute__ ((target ("sse2"))) static void
+blend_span_pixels_sse2 (Uint32 *dst, const Uint32 *src, int n)
+{
+  int i;
+  __m128i zero   = _mm_setzero_si128 ();
+  __m128i mask   = _mm_set1_epi32 (COLOR_MASK);
+  __m128i amask  = _mm_set1_epi32 (ALPHA (0xff));
+  __m128i s, d, sa, opaque, clear, blended;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    s = _mm_loadu_si128 ((const __m128i *) (src + i));
+    d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+
+    blended = _mm_packus_epi16 (
+      blend_lanes_sse2 (
+        _mm_unpacklo_epi8 (s, zero),
+        _mm_unpacklo_epi8 (d, zero)),
+      blend_lanes_sse2 (
+        _mm_unpackhi_epi8 (s, zero),
+        _mm_unpackhi_epi8 (d, zero)));
+
+    sa     = _mm_and_si128 (s, amask);
+    opaque = _mm_cmpeq_epi32 (sa, amask);
+    clear  = _mm_cmpeq_epi32 (sa, zero);
+
+    blended = _mm_or_si128 (
+      _mm_and_si128 (opaque, s),
+      _mm_andnot_si128 (_mm_or_si128 (opaque, clear), blended));
+
+    _mm_storeu_si128 (
+      (__m128i *) (dst + i),
+      _mm_or_si128 (
+        _mm_and_si128 (clear, d),
+        _mm_andnot_si128 (clear, _mm_and_si128 (blended, mask))));
+  }
+
+  blend_span_pixels_generic (dst + i, src + i, n - i);
+}
+
+__attribute__ ((target ("avx2"))) static void
+blend_span_color_avx2 (Uint32 *dst, int n, Uint32 color)
+{
+  int i;
+  int a = G_ALPHA (color);
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i mask = _mm256_set1_epi32 (COLOR_MASK);
+  __m256i k    = _mm256_set1_epi16 (256 - a);
+  __m256i ac   = _mm256_set_epi16 (
+    0, a * G_RED (color), a * G_GREEN (color), a * G_BLUE (color),
+    0, a * G_RED (color), a * G_GREEN (color), a * G_BLUE (color),
+    0, a * G_RED (color), a * G_GREEN (color), a * G_BLUE (color),
+    0, a * G_RED (color), a * G_GREEN (color), a * G_BLUE (color));
+  __m256i d, lo, hi;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    d  = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+    lo = _mm256_unpacklo_epi8 (d, zero);
+    hi = _mm256_unpackhi_epi8 (d, zero);
+
+    lo = _mm256_adds_epu16 (
+      _mm256_adds_epu16 (ac, _mm256_mullo_epi16 (lo, k)),
+      _mm256_add_epi16 (_mm256_slli_epi16 (lo, 1), lo));
+    hi = _mm256_adds_epu16 (
+      _mm256_adds_epu16 (ac, _mm256_mullo_epi16 (hi, k)),
+      _mm256_add_epi16 (_mm256_slli_epi16 (hi, 1), hi));
+
+    /* Unpack and pack both work within 128-bit lanes, so order holds */
+    d = _mm256_packus_epi16 (
+      _mm256_srli_epi16 (lo, 8),
+      _mm256_srli_epi16 (hi, 8));
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_and_si256 (d, mask));
+  }
+
+  blend_span_color_sse2 (dst + i, n - i, color);
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+blend_lanes_avx2 (__m256i s, __m256i d)
+{
+  __m256i a;
+
+  a = _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (s, 0xff), 0xff);
+
+  return _mm256_srli_epi16 (
+    _mm256_adds_epu16 (
+      _mm256_adds_epu16 (
+        _mm256_mullo_epi16 (a, s),
+        _mm256_mullo_epi16 (_mm256_sub_epi16 (_mm256_set1_epi16 (256), a), d)),
+      _mm256_add_epi16 (_mm256_slli_epi16 (d, 1), d)),
+    8);
+}
+
+__attribute__ ((target ("avx2"))) static void
+blend_span_pixels_avx2 (Uint32 *dst, const Uint32 *src, int n)
+{
+  int i;
+  __m256i zero   = _mm256_setzero_si256 ();
+  __m256i mask   = _mm256_set1_epi32 (COLOR_MASK);
+  __m256i amask  = _mm256_set1_epi32 (ALPHA (0xff));
+  __m256i s, d, sa, opaque, clear, blended;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    s = _mm256_loadu_si256 ((const __m256i *) (src + i));
+    d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+
+    blended = _mm256_packus_epi16 (
+      blend_lanes_avx2 (
+        _mm256_unpacklo_epi8 (s, zero),
+        _mm256_unpacklo_epi8 (d, zero)),
+      blend_lanes_avx2 (
+        _mm256_unpackhi_epi8 (s, zero),
+        _mm256_unpackhi_epi8 (d, zero)));
+
+    sa     = _mm256_and_si256 (s, amask);
+    opaque = _mm256_cmpeq_epi32 (sa, amask);
+    clear  = _mm256_cmpeq_epi32 (sa, zero);
+
+    blended = _mm256_or_si256 (
+      _mm256_and_si256 (opaque, s),
+      _mm256_andnot_si256 (_mm256_or_si256 (opaque, clear), blended));
+
+    _mm256_storeu_si256 (
+      (__m256i *) (dst + i),
+      _mm256_or_si256 (
+        _mm256_and_si256 (clear, d),
+        _mm256_andnot_si256 (clear, _mm256_and_si256 (blended, mask))));
+  }
+
+  blend_span_pixels_sse2 (dst + i, src + i, n - i);
+}
+#endif /* BLEND_X86 */
+
+/* Kernels are picked on first use, after checking what the CPU has */
+static void blend_span_color_resolve (Uint32 *, int, Uint32);
+static void blend_span_pixels_resolve (Uint32 *, const Uint32 *, int);
+
+static void (*blend_span_color_impl) (Uint32 *, int, Uint32) =
+  blend_span_color_resolve;
+static void (*blend_span_pixels_impl) (Uint32 *, const Uint32 *, int) =
+  blend_span_pixels_resolve;
+
+static void
+blend_resolve (void)
+{
+  blend_span_color_impl  = blend_span_color_generic;
+  blend_span_pixels_impl = blend_span_pixels_generic;
+
+#ifdef BLEND_X86
+  __builtin_cpu_init ();
+
+  if (__builtin_cpu_supports ("avx2"))
+  {
+    blend_span_color_impl  = blend_span_color_avx2;
+    blend_span_pixels_impl = blend_span_pixels_avx2;
+  }
+  else if (__builtin_cpu_supports ("sse2"))
+  {
+    blend_span_color_impl  = blend_span_color_sse2;
+    blend_span_pixels_impl = blend_span_pixels_sse2;
+  }
+#endif
+}
+
+static void
+blend_span_color_resolve (Uint32 *dst, int n, Uint32 color)
+{
+  blend_resolve ();
+  blend_span_color_impl (dst, n, color);
+}
+
+static void
+blend_span_pixels_resolve (Uint32 *dst, const Uint32 *src, int n)
+{
+  blend_resolve ();
+  blend_span_pixels_impl (dst, src, n);
+}
+
+/* Blend a color over n pixels */
+void
+blend_span_color (Uint32 *dst, int n, Uint32 color)
+{
+  int i;
+
+  if (!G_ALPHA (color))
+    return;
+
+  if (G_ALPHA (color) == 255)
+  {
+    for (i = 0; i < n; i++)
+      dst[i] = color & COLOR_MASK;
+
+    return;
+  }
+
+  blend_span_color_impl (dst, n, color);
+}
+
+/* Blend n ARGB pixels over dst, each with its own alpha */
+void
+blend_span_pixels (Uint32 *dst, const Uint32 *src, int n)
+{
+  blend_span_pixels_impl (dst, src, n);
+}
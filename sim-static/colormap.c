@@ -0,0 +1,269 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "draw.h"
+#include "colormap.h"
+
+#include <util.h>
+
+#define COLORMAP_MAX_POINTS 256
+
+struct colormap_point
+{
+  int r, g, b;
+};
+
+/* Evenly spaced anchors, linearly interpolated */
+static const struct colormap_point viridis_points[] =
+{
+  { 68,   1,  84}, { 71,  44, 122}, { 59,  81, 139},
+  { 44, 113, 142}, { 33, 144, 141}, { 39, 173, 129},
+  { 92, 200,  99}, {170, 220,  50}, {253, 231,  37}
+};
+
+static const struct colormap_point jet_points[] =
+{
+  {  0,   0, 128}, {  0,   0, 255}, {  0, 128, 255},
+  {  0, 255, 255}, {128, 255, 128}, {255, 255,   0},
+  {255, 128,   0}, {255,   0,   0}, {128,   0,   0}
+};
+
+static const char *colormap_names[] =
+{
+  "grayscale",
+  "viridis",
+  "jet",
+  "phosphor",
+  "hue"
+};
+
+static struct colormap *builtin_colormaps[COLORMAP_TYPE_COUNT];
+
+static struct colormap *
+colormap_alloc (int size)
+{
+  struct colormap *new;
+
+  new = xmalloc (sizeof (struct colormap));
+
+  new->size = size;
+  new->lut  = xmalloc (size * sizeof (Uint32));
+
+  return new;
+}
+
+static void
+colormap_interpolate (struct colormap *cmap,
+                      const struct colormap_point *points,
+                      int count)
+{
+  int i, n;
+  double t, f;
+
+  if (count == 1)
+  {
+    for (i = 0; i < cmap->size; i++)
+      cmap->lut[i] = OPAQUE (MAKECOL (points[0].r, points[0].g, points[0].b));
+
+    return;
+  }
+
+  for (i = 0; i < cmap->size; i++)
+  {
+    t = (double) i / (cmap->size - 1) * (count - 1);
+    n = (int) t;
+
+    if (n >= count - 1)
+      n = count - 2;
+
+    f = t - n;
+
+    cmap->lut[i] = OPAQUE (MAKECOL (
+      (int) ((1 - f) * points[n].r + f * points[n + 1].r),
+      (int) ((1 - f) * points[n].g + f * points[n + 1].g),
+      (int) ((1 - f) * points[n].b + f * points[n + 1].b)));
+  }
+}
+
+struct colormap *
+colormap_new (enum colormap_type type, int size)
+{
+  struct colormap *new;
+  int i, v;
+  double t;
+
+  if (size < 2)
+  {
+    ERROR ("colormap_new: invalid size %d\n", size);
+    return NULL;
+  }
+
+  new = colormap_alloc (size);
+
+  switch (type)
+  {
+    case COLORMAP_GRAYSCALE:
+      for (i = 0; i < size; i++)
+      {
+        v = 255 * i / (size - 1);
+        new->lut[i] = OPAQUE (MAKECOL (v, v, v));
+      }
+      break;
+
+    case COLORMAP_VIRIDIS:
+      colormap_interpolate (new, viridis_points,
+        sizeof (viridis_points) / sizeof (viridis_points[0]));
+      break;
+
+    case COLORMAP_JET:
+      colormap_interpolate (new, jet_points,
+        sizeof (jet_points) / sizeof (jet_points[0]));
+      break;
+
+    case COLORMAP_PHOSPHOR:
+      /* Black to green to white, with a square root so rare hits show */
+      for (i = 0; i < size; i++)
+      {
+        t = sqrt ((double) i / (size - 1));
+
+        new->lut[i] = OPAQUE (
+            RED   ((int) (255 * (t > .5 ? 2 * t - 1 : 0)))
+          | GREEN ((int) (255 * (t < .5 ? 2 * t : 1)))
+          | BLUE  ((int) (127 * (t > .5 ? 2 * t - 1 : 0))));
+      }
+      break;
+
+    case COLORMAP_HUE:
+      for (i = 0; i < size; i++)
+        new->lut[i] = OPAQUE (calc_color (i * (CALC_COLOR_CYCLE - 1) / (size - 1)));
+      break;
+
+    default:
+      ERROR ("colormap_new: unknown colormap type %d\n", type);
+      colormap_free (new);
+      return NULL;
+  }
+
+  return new;
+}
+
+/*
+ * Text file with one "R G B" triplet (0-255) per line, evenly spaced
+ * from the lowest to the highest intensity. Lines starting with `#'
+ * are ignored.
+ */
+struct colormap *
+colormap_from_file (const char *path, int size)
+{
+  FILE *fp;
+  struct colormap *new;
+  struct colormap_point points[COLORMAP_MAX_POINTS];
+  char line[RECOMMENDED_LINE_SIZE];
+  int count = 0;
+  int lineno = 0;
+
+  if ((fp = fopen (path, "r")) == NULL)
+  {
+    ERROR ("colormap_from_file: cannot open %s: %s\n", path, strerror (errno));
+    return NULL;
+  }
+
+  while (fgets (line, sizeof (line), fp) != NULL)
+  {
+    lineno++;
+
+    if (*line == '#' || *line == '\n' || *line == '\r')
+      continue;
+
+    if (count == COLORMAP_MAX_POINTS)
+    {
+      ERROR ("%s:%d: too many colors (max %d)\n",
+        path, lineno, COLORMAP_MAX_POINTS);
+      fclose (fp);
+      return NULL;
+    }
+
+    if (sscanf (line, "%d %d %d",
+      &points[count].r, &points[count].g, &points[count].b) != 3)
+    {
+      ERROR ("%s:%d: expected R G B triplet\n", path, lineno);
+      fclose (fp);
+      return NULL;
+    }
+
+    /* Saturate, a slightly wrong value must not wrap around */
+    points[count].r = MAX (0, MIN (255, points[count].r));
+    points[count].g = MAX (0, MIN (255, points[count].g));
+    points[count].b = MAX (0, MIN (255, points[count].b));
+
+    count++;
+  }
+
+  fclose (fp);
+
+  if (count == 0)
+  {
+    ERROR ("%s: no colors defined\n", path);
+    return NULL;
+  }
+
+  if (size < 2)
+  {
+    ERROR ("colormap_from_file: invalid size %d\n", size);
+    return NULL;
+  }
+
+  new = colormap_alloc (size);
+
+  colormap_interpolate (new, points, count);
+
+  return new;
+}
+
+/* Shared tables of COLORMAP_DEFAULT_SIZE entries, built on first use */
+const struct colormap *
+colormap_builtin (enum colormap_type type)
+{
+  if (type < 0 || type >= COLORMAP_TYPE_COUNT)
+    return NULL;
+
+  if (builtin_colormaps[type] == NULL)
+    builtin_colormaps[type] = colormap_new (type, COLORMAP_DEFAULT_SIZE);
+
+  return builtin_colormaps[type];
+}
+
+const char *
+colormap_name (enum colormap_type type)
+{
+  if (type < 0 || type >= COLORMAP_TYPE_COUNT)
+    return NULL;
+
+  return colormap_names[type];
+}
+
+void
+colormap_free (struct colormap *cmap)
+{
+  free (cmap->lut);
+  free (cmap);
+}
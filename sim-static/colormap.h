@@ -0,0 +1,73 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _COLORMAP_H
+#define _COLORMAP_H
+
+#include <SDL.h>
+
+#define COLORMAP_DEFAULT_SIZE 256
+#define COLORMAP_LARGE_SIZE   4096
+
+enum colormap_type
+{
+  COLORMAP_GRAYSCALE,
+  COLORMAP_VIRIDIS,
+  COLORMAP_JET,
+  COLORMAP_PHOSPHOR,
+  COLORMAP_HUE,
+  COLORMAP_TYPE_COUNT
+};
+
+/* Precomputed ARGB lookup table. Entries are opaque. */
+struct colormap
+{
+  int size;
+  Uint32 *lut;
+};
+
+struct colormap *colormap_new (enum colormap_type, int);
+struct colormap *colormap_from_file (const char *, int);
+const struct colormap *colormap_builtin (enum colormap_type);
+const char *colormap_name (enum colormap_type);
+void colormap_free (struct colormap *);
+
+static inline Uint32
+colormap_lookup (const struct colormap *cmap, int index)
+{
+  if (index < 0)
+    index = 0;
+  else if (index >= cmap->size)
+    index = cmap->size - 1;
+
+  return cmap->lut[index];
+}
+
+/* For code that has not quantized yet. x is in [0, 1], saturated */
+static inline int
+colormap_quantize (const struct colormap *cmap, double x)
+{
+  if (x <= 0)
+    return 0;
+  else if (x >= 1)
+    return cmap->size - 1;
+
+  return (int) (x * (cmap->size - 1));
+}
+
+#endif /* _COLORMAP_H */
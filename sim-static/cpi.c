@@ -22,6 +22,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/io.h>
 
 #include <util.h>
@@ -81,9 +82,7 @@ cpi_map_codepage (cpi_handle_t *handle, const char *path)
       memcmp (handle->cpi_file_header->tag, CPI_TAG_NT, 8) != 0)
   {
     ERROR ("cpi_map_codepage: invalid file (not a CPI file)\n");
-    munmap (handle->cpi_file, handle->cpi_file_size);
-    handle->cpi_file = NULL;
-    close (handle->cpi_fd);
+    cpi_unmap (handle);
     return -1;
   }
   
@@ -128,8 +127,6 @@ cpi_get_page (cpi_handle_t *handle, short cp)
     if (entry->device_type == 1 && entry->codepage == cp)
       return entry;
     
-    printf ("%d omissible\n", entry->codepage);
-    
     entry_count++;
     
     if (handle->font_is_nt)
@@ -157,7 +154,6 @@ cpi_get_page (cpi_handle_t *handle, short cp)
     }
     else
     {
-      printf ("Next entry is at 0x%08x\n", entry->next_entry);
       entry = (struct cpi_entry *) (handle->cpi_file + entry->next_entry);
     }
   }
@@ -278,7 +274,173 @@ void cpi_puts  (struct cpi_disp_font *font,
 void
 cpi_unmap (cpi_handle_t *handle)
 {
-  /* FIXME: FIX THIS! */
+  /* The built-in font isn't mapped */
+  if (handle->cpi_fd != -1)
+  {
+    if (handle->cpi_file != NULL)
+      munmap (handle->cpi_file, handle->cpi_file_size);
+    
+    close (handle->cpi_fd);
+  }
+  
+  handle->cpi_file = NULL;
+  handle->cpi_fd   = -1;
+}
+
+/*
+ * Font registry. Every CPI file is mapped once per process, and all
+ * its screen fonts are indexed by codepage and size when it is. The
+ * files are never unmapped: fonts are shared by displays and text
+ * areas, and glyph atlases are keyed by font address.
+ */
+static struct cpi_file *cpi_files;
+static pthread_mutex_t cpi_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+cpi_index_add (struct cpi_file *file, short cp, struct cpi_disp_font *font)
+{
+  if (file->font_count == file->font_size)
+  {
+    file->font_size = file->font_size ? 2 * file->font_size : 8;
+    file->fonts = xrealloc (file->fonts, 
+      file->font_size * sizeof (struct cpi_font_index));
+  }
+  
+  file->fonts[file->font_count].codepage = cp;
+  file->fonts[file->font_count].font     = font;
+  
+  file->font_count++;
+}
+
+/* One pass over the file, same walk as cpi_get_page and cpi_get_disp_font */
+static int
+cpi_index (struct cpi_file *file)
+{
+  cpi_handle_t *handle = &file->handle;
+  struct cpi_entry *entry;
+  struct cpi_font_info *info;
+  struct cpi_disp_font *font;
+  int entry_count;
+  int i;
+  long p;
+  
+  entry = (struct cpi_entry *) (handle->cpi_file + 
+    (handle->font_is_nt ? 0x19 : handle->cpi_file_header->info_off + 2));
+  
+  for (entry_count = 0; 
+       entry_count < handle->cpi_file_header->entry_no; 
+       entry_count++)
+  {
+    if (!in_bounds (handle, (long) entry - (long) handle->cpi_file))
+    {
+      ERROR ("cpi_index: entry 0x%lx (%d) out of bounds!\n",
+        (long) entry - (long) handle->cpi_file, entry_count);
+        
+      return -1;
+    }
+    
+    /* NT files have no pointer to the next entry, fonts are skipped */
+    if (entry->device_type == 1 || handle->font_is_nt)
+    {
+      if (!handle->font_is_nt && !in_bounds (handle, entry->font_info_ptr))
+      {
+        ERROR ("cpi_index: font info of entry %d out of bounds!\n", 
+          entry_count);
+        return -1;
+      }
+      
+      info = (struct cpi_font_info *) ((handle->font_is_nt ? 
+        (void *) entry + sizeof (struct cpi_entry) : 
+          handle->cpi_file + entry->font_info_ptr));
+      p = (long) info + sizeof (struct cpi_font_info);
+      
+      for (i = 0; i < info->font_no; i++)
+      {
+        if (!in_bounds (handle, p - (long) handle->cpi_file))
+        {
+          ERROR ("cpi_index: font 0x%lx (%d) out of bounds!\n", p, i);
+          return -1;
+        }
+        
+        font = (struct cpi_disp_font *) p;
+        
+        p += sizeof (struct cpi_disp_font) + 
+          BITS2BYTES (font->chars * font->rows * font->cols);
+        
+        /* Glyphs are read later on, all of them must be there */
+        if (entry->device_type == 1 && 
+            in_bounds (handle, p - 1 - (long) handle->cpi_file))
+          cpi_index_add (file, entry->codepage, font);
+      }
+    }
+    
+    if (handle->font_is_nt)
+      entry = (struct cpi_entry *) p;
+    else
+      entry = (struct cpi_entry *) (handle->cpi_file + entry->next_entry);
+  }
+  
+  return 0;
+}
+
+/* Shared handle of a CPI file, NULL path for the built-in one */
+struct cpi_file *
+cpi_open (const char *path)
+{
+  struct cpi_file *file;
+  
+  pthread_mutex_lock (&cpi_files_lock);
+  
+  for (file = cpi_files; file != NULL; file = file->next)
+    if (path == NULL ? 
+        file->path == NULL : 
+        file->path != NULL && strcmp (file->path, path) == 0)
+      goto done;
+  
+  file = xmalloc (sizeof (struct cpi_file));
+  
+  memset (file, 0, sizeof (struct cpi_file));
+  
+  if (cpi_map_codepage (&file->handle, path) == -1)
+  {
+    free (file);
+    file = NULL;
+    goto done;
+  }
+  
+  if (cpi_index (file) == -1)
+  {
+    ERROR ("cpi_open: %s: broken CPI file\n", path ? path : "built-in font");
+    cpi_unmap (&file->handle);
+    free (file->fonts);
+    free (file);
+    file = NULL;
+    goto done;
+  }
+  
+  file->path = path ? xstrdup (path) : NULL;
+  file->next = cpi_files;
+  
+  cpi_files = file;
+  
+done:
+  pthread_mutex_unlock (&cpi_files_lock);
+  
+  return file;
+}
+
+struct cpi_disp_font *
+cpi_find_font (struct cpi_file *file, short cp, int rows, int cols)
+{
+  int i;
+  
+  for (i = 0; i < file->font_count; i++)
+    if (file->fonts[i].codepage == cp &&
+        file->fonts[i].font->rows == rows &&
+        file->fonts[i].font->cols == cols)
+      return file->fonts[i].font;
+  
+  return NULL;
 }
 
 
@@ -80,8 +80,30 @@ typedef struct cpi_handle
 }
 cpi_handle_t;
 
+/* Screen font of a codepage, see cpi_open */
+struct cpi_font_index
+{
+  short codepage;
+  struct cpi_disp_font *font;
+};
+
+struct cpi_file
+{
+  char *path; /* NULL for the built-in font */
+  cpi_handle_t handle;
+  
+  struct cpi_font_index *fonts;
+  int font_count;
+  int font_size;
+  
+  struct cpi_file *next;
+};
+
 int cpi_map_codepage (cpi_handle_t *, const char *);
 
+struct cpi_file *cpi_open (const char *);
+struct cpi_disp_font *cpi_find_font (struct cpi_file *, short, int, int);
+
 struct cpi_entry *cpi_get_page (cpi_handle_t *, short);
 struct cpi_disp_font *cpi_get_disp_font 
   (cpi_handle_t *, struct cpi_entry *, int, int);
@@ -63,16 +63,106 @@ try_sdl_opengl (int width, int height)
 }
 #endif
 
+/* Common to the SDL backends */
+int
+sdl_init (void)
+{
+  if (SDL_Init (SDL_INIT_VIDEO) != 0)
+  {
+    ERROR ("Unable to initialize SDL: %s\n", SDL_GetError ());
+    return -1;
+  }
+ 
+  atexit (SDL_Quit);
+  
+  if (eventLock == NULL)
+    eventLock = SDL_CreateMutex ();    
+    
+  return 0;
+}
+
+#ifndef HAVE_SDL2
 static SDL_Surface *
 try_sdl_traditional (int width, int height)
 {
   return SDL_SetVideoMode (width, height, 32, SDL_DOUBLEBUF | SDL_HWSURFACE);
 }
 
+static int
+sdl_open (display_t *display)
+{
+  if (sdl_init () == -1)
+    return -1;
+  
+  /* if ((display->screen = try_sdl_opengl (display->width, display->height)) == NULL)
+  {
+    fprintf (stderr, "display_new: can't use OpenGL render, trying traditional\n");
+  */
+  
+    if ((display->screen = 
+      try_sdl_traditional (display->width, display->height)) == NULL)
+    {
+      ERROR ("Unable to set video mode: %s\n", SDL_GetError ());
+      return -1;
+    }
+    
+  /*
+  }
+  */
+  
+  SDL_WM_SetCaption ("libsim: simulation window",
+                     "libsim: simulation window");
+  
+  return 0;
+}
+
+static void
+sdl_update (display_t *display, int count, SDL_Rect *rects)
+{
+  SDL_UpdateRects (display->screen, count, rects);
+}
+
+static const struct display_backend display_sdl_backend =
+{
+  "sdl",
+  sdl_open,
+  sdl_update,
+  sdl_poll_events,
+  sdl_wait_events,
+  sdl_break_wait,
+  NULL
+};
+#endif /* HAVE_SDL2 */
+
+/* The first one is the default */
+static const struct display_backend *display_backends[] =
+{
+#ifdef HAVE_SDL2
+  &display_sdl2_backend,
+#else
+  &display_sdl_backend,
+#endif
+  &display_headless_backend,
+  NULL
+};
+
 display_t *
 display_new (int width, int height)
+{
+  return display_new_backend (getenv ("LIBSIM_BACKEND"), width, height);
+}
+
+/* 
+ * Same as display_new with the backend given by name, NULL for the
+ * default one. Frames are dumped if LIBSIM_DUMP is set, see
+ * display_set_frame_dump.
+ */
+display_t *
+display_new_backend (const char *backend, int width, int height)
 {
   display_t *new;
+  const char *dump;
+  int i;
   
   new = xmalloc (sizeof (display_t));
   
@@ -81,32 +171,27 @@ display_new (int width, int height)
   new->width = width;
   new->height = height;
   
-  if (SDL_Init (SDL_INIT_VIDEO) != 0)
+  new->clip_x2 = width;
+  new->clip_y2 = height;
+  
+  for (i = 0; display_backends[i] != NULL; i++)
+    if (backend == NULL || strcmp (display_backends[i]->name, backend) == 0)
+      break;
+  
+  if ((new->backend = display_backends[i]) == NULL)
   {
-    ERROR ("Unable to initialize SDL: %s\n", SDL_GetError ());
+    ERROR ("display_new: unknown backend `%s'\n", backend);
     free (new);
     
     return NULL;
   }
- 
-  atexit (SDL_Quit);
   
-  /* if ((new->screen = try_sdl_opengl (width, height)) == NULL)
+  if (new->backend->open (new) == -1)
   {
-    fprintf (stderr, "display_new: can't use OpenGL render, trying traditional\n");
-  */
-  
-    if ((new->screen = try_sdl_traditional (width, height)) == NULL)
-    {
-      ERROR ("Unable to set video mode: %s\n", SDL_GetError ());
-      free (new);
-      
-      return NULL;
-    }
+    free (new);
     
-  /*
+    return NULL;
   }
-  */
   
   if ((new->whole_screen = display_textarea_new (
     new, 
@@ -127,9 +212,6 @@ display_new (int width, int height)
   
   textarea_set_autorefresh (new->whole_screen, 1);
   
-  SDL_WM_SetCaption ("libsim: simulation window",
-                     "libsim: simulation window");
-  
   memset (new->screen->pixels, 0, width * height * sizeof (Uint32));
   
   new->kbd_hooks = hook_bucket_new (512);
@@ -139,11 +221,26 @@ display_new (int width, int height)
   if (display_select_cpi (new, NULL) != -1)
     (void) display_select_font (new, DEFAULT_CODEPAGE, DEFAULT_FONT_SIZE);
 
-  if (eventLock == NULL)
-    eventLock = SDL_CreateMutex ();    
+  if ((dump = getenv ("LIBSIM_DUMP")) != NULL)
+    display_set_frame_dump (new, dump);
+    
   return new;
 }
 
+/*
+ * Save every refreshed frame that changed as a BMP. The pattern is a
+ * printf format taking the frame number, NULL turns dumping off.
+ */
+void
+display_set_frame_dump (display_t *display, const char *pattern)
+{
+  if (display->dump_pattern != NULL)
+    free (display->dump_pattern);
+  
+  display->dump_pattern = pattern != NULL ? xstrdup (pattern) : NULL;
+  display->dump_frame = 0;
+}
+
 static struct area_info*
 area_info_new (void)
 {
@@ -236,6 +333,11 @@ __parse_event (display_t *display, SDL_Event *event)
   {
     case SDL_KEYDOWN:
     case SDL_KEYUP:
+#ifdef HAVE_SDL2
+      /* Same as SDL 1.2: no key repeat, no hooks for non-ASCII keys */
+      if (event->key.repeat || (event->key.keysym.sym & SDLK_SCANCODE_MASK))
+        break;
+#endif
     
       event_info.type  = EVENT_TYPE_KEYBOARD;
       event_info.code  = event->key.keysym.sym;
@@ -259,7 +361,7 @@ __parse_event (display_t *display, SDL_Event *event)
 }
 
 void
-display_poll_events (display_t *display)
+sdl_poll_events (display_t *display)
 {
   SDL_Event event;
 
@@ -268,18 +370,18 @@ display_poll_events (display_t *display)
 }
 
 void
-display_wait_events (display_t *display)
+sdl_wait_events (display_t *display)
 {
   SDL_Event event;
   
   SDL_WaitEvent (&event);
   __parse_event (display, &event);
   
-  display_poll_events (display);
+  sdl_poll_events (display);
 }
 
 void
-display_break_wait (display_t *display)
+sdl_break_wait (display_t *display)
 {
   SDL_Event event;
   
@@ -293,17 +395,52 @@ display_break_wait (display_t *display)
   SDL_UnlockMutex (eventLock);
 }
 
+void
+display_poll_events (display_t *display)
+{
+  display->backend->poll_events (display);
+}
+
+void
+display_wait_events (display_t *display)
+{
+  display->backend->wait_events (display);
+}
+
+void
+display_break_wait (display_t *display)
+{
+  display->backend->break_wait (display);
+}
+
 void
 display_refresh (display_t *display)
 {
+  struct text_area *area;
+  char *path;
+  
+  for (area = display->textareas; area != NULL; area = area->next)
+    textarea_flush (area);
+  
+  display_sync (display);
+  
   if (display->dirty)
   {
-    SDL_UpdateRect (display->screen, 
-      display->min_x, display->min_y,
-      display->max_x - display->min_x + 1,
-      display->max_y - display->min_y + 1);
+    display->backend->update (display, 
+      display->dirty_count, display->dirty_rects);
       
     display->dirty = 0;
+    display->dirty_count = 0;
+    
+    if (display->dump_pattern != NULL)
+    {
+      path = strbuild (display->dump_pattern, display->dump_frame++);
+      
+      if (display_dump (path, display) == -1)
+        ERROR ("display_refresh: cannot dump frame to %s\n", path);
+        
+      free (path);
+    }
   }
   
   /* Add some if */
@@ -319,6 +456,8 @@ display_to_draw (display_t *display)
   
   struct draw *output;
   
+  display_sync (display);
+  
   output = draw_new (display->width, display->height);
   
   for (j = 0; j < display->height; j++)
@@ -407,6 +546,12 @@ display_end (display_t *display)
 {
   display_refresh (display);
   
+  if (display->backend->end != NULL)
+  {
+    display->backend->end (display);
+    return;
+  }
+  
   for (;;) 
     display_wait_events (display);
 }
@@ -20,17 +20,27 @@
 #define _DRAW_H
 
 #include <SDL.h>
+#include <string.h>
 #include <math.h>
 #include <complex.h>
 
 #include "wbmp.h"
 #include "cpi.h"
+#include "colormap.h"
 
 #include "hook.h"
 
 #define EVENT_TYPE_KEYBOARD 0
 #define EVENT_TYPE_MOUSE    1
 
+#define DISPLAY_DIRTY_RECTS  16 /* Rectangles flushed per refresh */
+#define DISPLAY_DIRTY_MARGIN 16 /* Gap below which two of them merge */
+
+#define DISPLAY_TILE_SIZE    64 /* Side of a tile in tiled rendering */
+
+struct tile_queue;
+struct text_cache;
+struct display_backend;
 
 struct display_info
 {
@@ -38,8 +48,23 @@ struct display_info
   
   int width, height;
   
-  int min_x, min_y;
-  int max_x, max_y;
+  SDL_Rect dirty_rects[DISPLAY_DIRTY_RECTS];
+  int dirty_count;
+  int dirty_last;
+  
+  /* Primitives only touch pixels in [clip_x1, clip_x2) x [clip_y1, clip_y2) */
+  int clip_x1, clip_y1;
+  int clip_x2, clip_y2;
+  
+  struct tile_queue *tiles; /* Non-NULL if drawing is recorded in tiles */
+  
+  struct text_cache *text_cache; /* Labels drawn by display_puts */
+  
+  const struct display_backend *backend;
+  void *backend_data;
+  
+  char *dump_pattern;       /* Non-NULL if refreshed frames are saved */
+  unsigned int dump_frame;
   
   int cpi_selected;
   
@@ -51,9 +76,10 @@ struct display_info
   struct cpi_disp_font *selected_font;
   struct hook_bucket *kbd_hooks;
   struct text_area *whole_screen;
+  struct text_area *textareas;
   struct area_info *areas;
   
-  cpi_handle_t cpi_handle;
+  struct cpi_file *cpi_file; /* Shared, see cpi_open */
 };
 
 struct event_info;
@@ -64,6 +90,39 @@ typedef int (*generic_handler_t) (int, struct display_info *, struct event_info
 
 typedef generic_handler_t kbd_handler_t;
 
+/* 
+ * Where the screen is shown. open sets up display->screen, with the
+ * pixels as 32-bit 0RGB words, width pixels per row. update gets the
+ * rectangles changed since the last refresh. end, if not NULL, lets
+ * display_end return: it releases the backend, nobody is there to
+ * close the window.
+ */
+struct display_backend
+{
+  const char *name;
+  int  (*open) (struct display_info *);
+  void (*update) (struct display_info *, int, SDL_Rect *);
+  void (*poll_events) (struct display_info *);
+  void (*wait_events) (struct display_info *);
+  void (*break_wait) (struct display_info *);
+  void (*end) (struct display_info *);
+};
+
+/* Plain framebuffer, no window and no events but display_break_wait.
+   display_end returns after the last refresh. */
+extern const struct display_backend display_headless_backend;
+
+#ifdef HAVE_SDL2
+/* Streaming texture, presented in sync with the monitor refresh */
+extern const struct display_backend display_sdl2_backend;
+#endif
+
+/* SDL initialization and event loop, shared by the SDL backends */
+int  sdl_init (void);
+void sdl_poll_events (struct display_info *);
+void sdl_wait_events (struct display_info *);
+void sdl_break_wait (struct display_info *);
+
 struct area_info
 {
   int x, y;
@@ -85,12 +144,18 @@ struct event_info
 
 
 
+/* Character of a text area */
+struct text_cell
+{
+  Uint32 color, bgcolor;
+  unsigned char c;
+  unsigned char blank; /* No character, black after a scroll */
+};
+
 struct text_area
 {
   struct cpi_disp_font *selected_font;
   
-  cpi_handle_t cpi_handle;
-  
   int cursor_x, cursor_y;
   int cpi_width, cpi_height;
   
@@ -98,7 +163,14 @@ struct text_area
   int color, bgcolor;
   
   int autorefresh;
+  
+  struct text_cell *cells; /* Ring of rows, drawn by display_refresh */
+  struct text_cell *shown; /* What the screen has, row 0 first */
+  int top;                 /* Row of the ring shown first */
+  int changed;
+  
   struct display_info *display;
+  struct text_area *next;  /* In display->textareas */
 };
 
 
@@ -130,9 +202,55 @@ px2pt_y (display_t *disp, int y)
   return ((disp->height >> 1) - (double) y) / disp->zoom - disp->offset_y;
 }
 
+/* Small ARGB image stamped with sprite_blit. Alpha 0 is transparent. */
+struct sprite
+{
+  int width;
+  int height;
+  int hot_x; /* Pixel that lands on the coordinates passed to sprite_blit */
+  int hot_y;
+  Uint32 *pixels;
+};
+
+/* A font expanded to pixels in one pair of colors, see glyph.c */
+struct glyph_atlas;
+
+struct glyph_atlas *glyph_atlas_get (struct cpi_disp_font *, Uint32, Uint32);
+void glyph_atlas_puts (struct display_info *, const struct glyph_atlas *,
+                       int, int, const char *);
+
+void blend_span_color (Uint32 *, int, Uint32);
+void blend_span_pixels (Uint32 *, const Uint32 *, int);
+
+/*
+ * Tiled rendering. While display->tiles is set, primitives don't touch
+ * the screen: they are recorded into per-tile bins and rasterized by a
+ * thread pool in display_sync, which display_refresh calls. Pixels
+ * passed to blit, text and polyline values are copied; sprites are
+ * not, and must live until the next sync. pget reads what was last
+ * synced.
+ */
+int  display_set_tiled (display_t *, int);
+void display_sync (display_t *);
+
+void tile_record_pset (display_t *, int, int, Uint32);
+void tile_record_line (display_t *, int, int, int, int, Uint32);
+void tile_record_rect (display_t *, int, int, int, int, Uint32);
+void tile_record_blit (display_t *, int, int, int, int, const Uint32 *, int);
+void tile_record_sprite (display_t *, int, int, const struct sprite *);
+void tile_record_text (display_t *, int, int, Uint32, Uint32, const char *);
+void tile_record_polyline (display_t *, int, int, const int *, int, int, Uint32);
+
 #include "pixel.h"
 
+struct sprite *sprite_new (int, int, int, int);
+struct sprite *sprite_new_mark (int, Uint32, Uint32);
+struct sprite *sprite_grab (display_t *, int, int, int, int);
+void sprite_free (struct sprite *);
+
 display_t *display_new (int, int);
+display_t *display_new_backend (const char *, int, int);
+void display_set_frame_dump (display_t *, const char *);
 void display_refresh (display_t *);
 struct draw *display_to_draw (display_t *);
 void draw_to_display (display_t *, struct draw *, int, int, int);
@@ -146,6 +264,7 @@ void display_printf (display_t *, int, int, int, int, const char *, ...);
 void display_poll_events (display_t *); 
 void display_wait_events (display_t *);
 void display_break_wait (display_t *);
+int  display_register_key_handler (display_t *, int, kbd_handler_t);
 int  display_area_register (display_t *, int, int, int, int, mouse_handler_t, void *);
 void display_end (display_t *);
 
@@ -153,6 +272,8 @@ textarea_t *display_textarea_new
   (display_t *, int, int, int, int, const char *, int, int);
 void cputs (textarea_t *, const char *); /* Why C?? */
 void cprintf (textarea_t *, const char *, ...);
+void textarea_put_symbols (textarea_t *, const char *, const Uint32 *, int);
+void textarea_flush (textarea_t *);
 int  textarea_gotoxy (textarea_t *, int, int);
 
 #define disputs(disp, str) cputs (disp->whole_screen, str)
@@ -0,0 +1,210 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <util.h>
+
+#include "draw.h"
+
+/*
+ * Glyph atlases. The glyphs of a font are expanded once to 32-bit
+ * pixels in a given pair of colors, so drawing a character is a copy
+ * per row instead of a bit test per pixel. If the background is
+ * transparent, a mask of all ones where the glyph bit is set selects
+ * which pixels are written. Pixels come out exactly as cpi_puts would
+ * write them.
+ */
+
+#define GLYPH_ATLAS_MAX   32  /* Atlases kept, past that text is slow */
+#define GLYPH_ATLAS_CHARS 256 /* Text is indexed by unsigned char */
+
+struct glyph_atlas
+{
+  struct cpi_disp_font *font;
+  Uint32 fg, bg;
+
+  int rows;
+  int chars;
+
+  Uint32 *pixels; /* chars glyphs of rows x 8 pixels, one after another */
+  Uint32 *mask;   /* Same layout, NULL if the background is opaque */
+};
+
+/* Only looked up by the drawing thread, tile workers get the pointer */
+static struct glyph_atlas *atlas_list[GLYPH_ATLAS_MAX];
+static int atlas_count;
+static int atlas_last;
+
+static struct glyph_atlas *
+glyph_atlas_new (struct cpi_disp_font *font, Uint32 fg, Uint32 bg)
+{
+  struct glyph_atlas *new;
+  struct glyph *glyph;
+  int transpbg = !(bg & 0xff000000);
+  int size;
+  int c, i, j, p;
+
+  new = xmalloc (sizeof (struct glyph_atlas));
+
+  new->font  = font;
+  new->fg    = fg;
+  new->bg    = bg;
+  new->rows  = font->rows;
+  new->chars = font->chars < GLYPH_ATLAS_CHARS ?
+    font->chars : GLYPH_ATLAS_CHARS;
+
+  size = new->chars * new->rows * 8;
+
+  new->pixels = xmalloc (size * sizeof (Uint32));
+  new->mask   = transpbg ? xmalloc (size * sizeof (Uint32)) : NULL;
+
+  for (c = 0; c < new->chars; c++)
+  {
+    glyph = cpi_get_glyph (font, c);
+
+    for (j = 0; j < new->rows; j++)
+      for (i = 0; i < 8; i++)
+      {
+        p = (c * new->rows + j) * 8 + i;
+
+        if (glyph->bits[j] & (1 << (7 - i)))
+        {
+          new->pixels[p] = fg;
+
+          if (transpbg)
+            new->mask[p] = 0xffffffff;
+        }
+        else if (transpbg)
+          new->pixels[p] = new->mask[p] = 0;
+        else
+          new->pixels[p] = bg;
+      }
+  }
+
+  return new;
+}
+
+/*
+ * Atlas of a font in the given colors, built on first use. NULL if
+ * the font can't have one, or if there are too many atlases already.
+ */
+struct glyph_atlas *
+glyph_atlas_get (struct cpi_disp_font *font, Uint32 fg, Uint32 bg)
+{
+  struct glyph_atlas *atlas;
+  int i;
+
+  /* Every character of a text area usually hits the same one */
+  if (atlas_count > 0)
+  {
+    atlas = atlas_list[atlas_last];
+
+    if (atlas->font == font && atlas->fg == fg && atlas->bg == bg)
+      return atlas;
+  }
+
+  for (i = 0; i < atlas_count; i++)
+  {
+    atlas = atlas_list[i];
+
+    if (atlas->font == font && atlas->fg == fg && atlas->bg == bg)
+    {
+      atlas_last = i;
+      return atlas;
+    }
+  }
+
+  if (font->cols != 8 || atlas_count == GLYPH_ATLAS_MAX)
+    return NULL;
+
+  atlas_last = atlas_count;
+
+  return atlas_list[atlas_count++] = glyph_atlas_new (font, fg, bg);
+}
+
+/*
+ * Same as cpi_puts on the screen, text is cut at the last character
+ * that fits. Only pixels inside the clip rectangle are written.
+ */
+void
+glyph_atlas_puts (display_t *display, const struct glyph_atlas *atlas,
+                  int x, int y, const char *text)
+{
+  Uint32 *pixels = display->screen->pixels;
+  const Uint32 *src, *mask;
+  Uint32 *dst;
+  int len, rows;
+  int x1, x2, y1, y2;
+  int c, i, j, n;
+
+  len = strlen (text);
+
+  if (8 * len + x > display->width)
+    len = (display->width - x) / 8;
+
+  rows = atlas->rows;
+
+  if (rows + y > display->height)
+    rows = display->height - y;
+
+  y1 = y > display->clip_y1 ? y : display->clip_y1;
+  y2 = y + rows < display->clip_y2 ? y + rows : display->clip_y2;
+
+  if (y1 >= y2)
+    return;
+
+  for (n = 0; n < len; n++)
+  {
+    c = (unsigned char) text[n];
+
+    if (c >= atlas->chars)
+      continue;
+
+    x1 = x + 8 * n;
+    x2 = x1 + 8;
+
+    if (x1 < display->clip_x1)
+      x1 = display->clip_x1;
+
+    if (x2 > display->clip_x2)
+      x2 = display->clip_x2;
+
+    if (x1 >= x2)
+      continue;
+
+    for (j = y1; j < y2; j++)
+    {
+      i   = (c * atlas->rows + j - y) * 8 + x1 - x - 8 * n;
+      src = atlas->pixels + i;
+      dst = pixels + x1 + j * display->width;
+
+      if (atlas->mask == NULL)
+        memcpy (dst, src, (x2 - x1) * sizeof (Uint32));
+      else
+      {
+        mask = atlas->mask + i;
+
+        for (i = 0; i < x2 - x1; i++)
+          dst[i] = (dst[i] & ~mask[i]) | src[i];
+      }
+    }
+  }
+}
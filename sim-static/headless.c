@@ -0,0 +1,158 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <util.h>
+
+#include "draw.h"
+
+/*
+ * Headless backend: the screen is a plain framebuffer in memory, so
+ * drawing runs without SDL video (servers, benchmarks, unattended
+ * reports). The surface only wraps the buffer, which SDL can do
+ * without being initialized. Nothing is shown and there are no input
+ * events; display_wait_events sleeps until display_break_wait, and
+ * display_end returns once the last frame is refreshed.
+ */
+
+#define HEADLESS_ALIGN 64 /* Rows start cache line aligned, for SIMD */
+
+struct headless_data
+{
+  Uint32 *pixels;
+  
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  int woken;
+};
+
+static int
+headless_open (display_t *display)
+{
+  struct headless_data *data;
+  
+  data = xmalloc (sizeof (struct headless_data));
+  
+  memset (data, 0, sizeof (struct headless_data));
+  
+  if (posix_memalign (
+      (void **) &data->pixels, 
+      HEADLESS_ALIGN, 
+      display->width * display->height * sizeof (Uint32)) != 0)
+  {
+    ERROR ("headless_open: cannot allocate framebuffer\n");
+    free (data);
+    
+    return -1;
+  }
+  
+  if ((display->screen = SDL_CreateRGBSurfaceFrom (
+      data->pixels,
+      display->width,
+      display->height,
+      32,
+      display->width * sizeof (Uint32),
+      0xff0000,
+      0x00ff00,
+      0x0000ff,
+      0)) == NULL)
+  {
+    ERROR ("headless_open: cannot create surface: %s\n", SDL_GetError ());
+    free (data->pixels);
+    free (data);
+    
+    return -1;
+  }
+  
+  pthread_mutex_init (&data->lock, NULL);
+  pthread_cond_init (&data->cond, NULL);
+  
+  display->backend_data = data;
+  
+  return 0;
+}
+
+static void
+headless_update (display_t *display, int count, SDL_Rect *rects)
+{
+  /* Nothing to show, the pixels are already where they belong */
+}
+
+static void
+headless_poll_events (display_t *display)
+{
+}
+
+static void
+headless_wait_events (display_t *display)
+{
+  struct headless_data *data = display->backend_data;
+  
+  pthread_mutex_lock (&data->lock);
+  
+  while (!data->woken)
+    pthread_cond_wait (&data->cond, &data->lock);
+  
+  data->woken = 0;
+  
+  pthread_mutex_unlock (&data->lock);
+}
+
+static void
+headless_break_wait (display_t *display)
+{
+  struct headless_data *data = display->backend_data;
+  
+  pthread_mutex_lock (&data->lock);
+  data->woken = 1;
+  pthread_cond_signal (&data->cond);
+  pthread_mutex_unlock (&data->lock);
+}
+
+/* The display can't be drawn on anymore */
+static void
+headless_end (display_t *display)
+{
+  struct headless_data *data = display->backend_data;
+  
+  SDL_FreeSurface (display->screen);
+  display->screen = NULL;
+  
+  pthread_cond_destroy (&data->cond);
+  pthread_mutex_destroy (&data->lock);
+  
+  free (data->pixels);
+  free (data);
+  
+  display->backend_data = NULL;
+}
+
+const struct display_backend display_headless_backend =
+{
+  "headless",
+  headless_open,
+  headless_update,
+  headless_poll_events,
+  headless_wait_events,
+  headless_break_wait,
+  headless_end
+};
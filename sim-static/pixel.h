@@ -46,48 +46,168 @@
 
 #define LUMINANCE(color) ((257 * (int) G_RED (color) + 504 * (int) G_GREEN (color) + 98 * (int) G_BLUE (color) + 16000) / 1000)
 
+/* Distance between two rects once the gap is bridged, 0 if they touch */
+static inline int
+__dirty_gap (const SDL_Rect *a, int x, int y, int w, int h)
+{
+  int gx = 0, gy = 0;
+
+  if (x > a->x + a->w)
+    gx = x - (a->x + a->w);
+  else if (a->x > x + w)
+    gx = a->x - (x + w);
+
+  if (y > a->y + a->h)
+    gy = y - (a->y + a->h);
+  else if (a->y > y + h)
+    gy = a->y - (y + h);
+
+  return gx > gy ? gx : gy;
+}
+
+/* Pixels added to a by growing it to cover the rect (x, y, w, h) */
+static inline int
+__dirty_growth (const SDL_Rect *a, int x, int y, int w, int h)
+{
+  int x1 = a->x < x ? a->x : x;
+  int y1 = a->y < y ? a->y : y;
+  int x2 = a->x + a->w > x + w ? a->x + a->w : x + w;
+  int y2 = a->y + a->h > y + h ? a->y + a->h : y + h;
+
+  return (x2 - x1) * (y2 - y1) - a->w * a->h;
+}
+
 static inline void
-__make_dirty (display_t *display, int x, int y)
+__dirty_grow (SDL_Rect *a, int x, int y, int w, int h)
+{
+  int x2 = a->x + a->w > x + w ? a->x + a->w : x + w;
+  int y2 = a->y + a->h > y + h ? a->y + a->h : y + h;
+
+  if (x < a->x)
+    a->x = x;
+
+  if (y < a->y)
+    a->y = y;
+
+  a->w = x2 - a->x;
+  a->h = y2 - a->y;
+}
+
+/*
+ * Mark a w x h rectangle as changed. The display keeps a short list of
+ * disjoint-ish rectangles: a new one is merged into any rectangle less
+ * than DISPLAY_DIRTY_MARGIN pixels away, so nearby updates collapse
+ * while far apart widgets (a constellation and the status line, say)
+ * are uploaded separately. When the list is full the new rectangle goes
+ * into whichever one grows least.
+ */
+static inline void
+__make_dirty_rect (display_t *display, int x, int y, int w, int h)
 {
-  if (!display->dirty)
+  int i, best, growth, best_growth;
+  SDL_Rect *r;
+
+  if (x < 0)
   {
-    display->dirty = 1;
-    display->min_x = display->max_x = x;
-    display->min_y = display->max_y = y;
+    w += x;
+    x = 0;
   }
-  else
+
+  if (y < 0)
   {
-    if (display->min_x > x)
-    {
-      if (x < 0)
-        x = 0;
-      display->min_x = x;
-    }
-    
-    if (display->max_x < x)
-    {
-      if (x >= display->width)
-        x = display->width - 1;
-        
-      display->max_x = x;
-    }
-    
-    if (display->min_y > y)
-    {
-      if (y < 0)
-        y = 0;
-        
-      display->min_y = y;
-    }
-    
-    if (display->max_y < y)
+    h += y;
+    y = 0;
+  }
+
+  if (x + w > display->width)
+    w = display->width - x;
+
+  if (y + h > display->height)
+    h = display->height - y;
+
+  if (w <= 0 || h <= 0)
+    return;
+
+  display->dirty = 1;
+
+  /* Most calls land next to the previous one */
+  r = display->dirty_rects + display->dirty_last;
+
+  if (display->dirty_count > 0
+      && x >= r->x && y >= r->y
+      && x + w <= r->x + r->w && y + h <= r->y + r->h)
+    return;
+
+  for (i = 0; i < display->dirty_count; i++)
+    if (__dirty_gap (display->dirty_rects + i, x, y, w, h)
+        <= DISPLAY_DIRTY_MARGIN)
+      break;
+
+  if (i == display->dirty_count && i < DISPLAY_DIRTY_RECTS)
+  {
+    r = display->dirty_rects + display->dirty_count++;
+
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+
+    display->dirty_last = i;
+
+    return;
+  }
+
+  if (i == display->dirty_count)
+  {
+    best = 0;
+    best_growth = __dirty_growth (display->dirty_rects, x, y, w, h);
+
+    for (i = 1; i < display->dirty_count; i++)
+      if ((growth = __dirty_growth (display->dirty_rects + i, x, y, w, h))
+          < best_growth)
+      {
+        best = i;
+        best_growth = growth;
+      }
+
+    i = best;
+  }
+
+  r = display->dirty_rects + i;
+  __dirty_grow (r, x, y, w, h);
+
+  /* The grown rect may now reach others, fold them in */
+  for (i = 0; i < display->dirty_count; i++)
+  {
+    if (display->dirty_rects + i == r)
+      continue;
+
+    if (__dirty_gap (display->dirty_rects + i, r->x, r->y, r->w, r->h)
+        <= DISPLAY_DIRTY_MARGIN)
     {
-      if (y >= display->height)
-        y = display->height - 1;
-        
-      display->max_y = y;
+      __dirty_grow (r, 
+                    display->dirty_rects[i].x, 
+                    display->dirty_rects[i].y,
+                    display->dirty_rects[i].w,
+                    display->dirty_rects[i].h);
+
+      /* Move the last one into the hole and look at it again */
+      if (r == display->dirty_rects + display->dirty_count - 1)
+        r = display->dirty_rects + i;
+
+      display->dirty_rects[i] = display->dirty_rects[--display->dirty_count];
+
+      i = -1;
     }
   }
+
+  display->dirty_last = r - display->dirty_rects;
+}
+
+static inline void
+__make_dirty (display_t *display, int x, int y)
+{
+  __make_dirty_rect (display, x, y, 1, 1);
 }
 
 static inline int 
@@ -115,11 +235,26 @@ alphacolor (display_t *display, Uint32 base, Uint32 color)
   return MAKECOL (BYTEBOUND (red), BYTEBOUND (green), BYTEBOUND (blue));                                         
 }                                                                                                    
 
+/* Unsigned, so negative coordinates wrap around and fail the test */
+static inline int
+__in_clip (display_t *display, Uint32 x, Uint32 y)
+{
+  return x - display->clip_x1 < display->clip_x2 - display->clip_x1
+      && y - display->clip_y1 < display->clip_y2 - display->clip_y1;
+}
+
 static inline void 
 pset (display_t *display, Uint32 x, Uint32 y, Uint8 r, Uint8 g, Uint8 b)
 {
   int col;
-  if (x < display->width && y < display->height)
+  
+  if (display->tiles != NULL)
+  {
+    tile_record_pset (display, x, y, OPAQUE (MAKECOL (r, g, b)));
+    return;
+  }
+  
+  if (__in_clip (display, x, y))
   {
     col = MAKECOL (r, g, b);
     
@@ -148,7 +283,13 @@ pset_abs (display_t *display, Uint32 x, Uint32 y, Uint32 col)
   if (!G_ALPHA (col))
     return;
     
-  if (x < display->width && y < display->height)
+  if (display->tiles != NULL)
+  {
+    tile_record_pset (display, x, y, col);
+    return;
+  }
+  
+  if (__in_clip (display, x, y))
   {
     col = alphacolor (display, pget (display, x, y), col);
     
@@ -161,125 +302,551 @@ pset_abs (display_t *display, Uint32 x, Uint32 y, Uint32 col)
 }
 
 
+/*
+ * Clip a w x h rectangle at (x, y) to the clip rectangle. Returns 0 if
+ * nothing is left of it.
+ */
+static inline int
+__clip_rect (display_t *display, int *x, int *y, int *w, int *h)
+{
+  if (*x < display->clip_x1)
+  {
+    *w -= display->clip_x1 - *x;
+    *x = display->clip_x1;
+  }
+
+  if (*y < display->clip_y1)
+  {
+    *h -= display->clip_y1 - *y;
+    *y = display->clip_y1;
+  }
+
+  if (*x + *w > display->clip_x2)
+    *w = display->clip_x2 - *x;
+
+  if (*y + *h > display->clip_y2)
+    *h = display->clip_y2 - *y;
+
+  return *w > 0 && *h > 0;
+}
+
+/* Span kernels: n pixels from dst on, no clipping or dirty tracking */
+static inline void
+span_fill (Uint32 *dst, int n, Uint32 color)
+{
+  int i;
+
+  color &= COLOR_MASK;
+
+  /* Plain stores, vectorized by the compiler */
+  for (i = 0; i < n; i++)
+    dst[i] = color;
+}
+
+/* Same result as alphacolor on every pixel, see blend.c */
+static inline void
+span_blend (display_t *display, Uint32 *dst, int n, Uint32 color)
+{
+  blend_span_color (dst, n, color);
+}
+
+static inline void
+span_draw (display_t *display, Uint32 *dst, int n, Uint32 color)
+{
+  if (G_ALPHA (color) == 255)
+    span_fill (dst, n, color);
+  else
+    span_blend (display, dst, n, color);
+}
+
+/* Horizontal span from x1 to x2, both included */
+static inline void
+hline_fill (display_t *display, int x1, int x2, int y, Uint32 color)
+{
+  int w, h = 1;
+
+  if (!G_ALPHA (color))
+    return;
+
+  if (x1 > x2)
+  {
+    w = x1;
+    x1 = x2;
+    x2 = w;
+  }
+
+  w = x2 - x1 + 1;
+
+  if (display->tiles != NULL)
+  {
+    tile_record_rect (display, x1, y, w, h, color);
+    return;
+  }
+
+  if (!__clip_rect (display, &x1, &y, &w, &h))
+    return;
+
+  span_draw (display,
+             (Uint32 *) display->screen->pixels + x1 + y * display->width,
+             w,
+             color);
+
+  __make_dirty_rect (display, x1, y, w, 1);
+}
+
+/* Filled w x h rectangle, clipped once and drawn span by span */
+static inline void
+rect_fill (display_t *display, int x, int y, int w, int h, Uint32 color)
+{
+  int j;
+  Uint32 *row;
+
+  if (!G_ALPHA (color))
+    return;
+
+  if (display->tiles != NULL)
+  {
+    tile_record_rect (display, x, y, w, h, color);
+    return;
+  }
+
+  if (!__clip_rect (display, &x, &y, &w, &h))
+    return;
+
+  row = (Uint32 *) display->screen->pixels + x + y * display->width;
+
+  for (j = 0; j < h; j++, row += display->width)
+    span_draw (display, row, w, color);
+
+  __make_dirty_rect (display, x, y, w, h);
+}
+
+/* Opaque copy of a w x h block of pixels, clipped once, row by row */
+static inline void
+blit (display_t *display, int x, int y, int w, int h,
+      const Uint32 *pixels, int pitch)
+{
+  int j;
+  int x0 = x, y0 = y;
+
+  if (display->tiles != NULL)
+  {
+    tile_record_blit (display, x, y, w, h, pixels, pitch);
+    return;
+  }
+
+  if (!__clip_rect (display, &x, &y, &w, &h))
+    return;
+
+  pixels += (x - x0) + (y - y0) * pitch;
+
+  for (j = 0; j < h; j++)
+    memcpy ((Uint32 *) display->screen->pixels + x + (y + j) * display->width,
+            pixels + j * pitch,
+            w * sizeof (Uint32));
+
+  __make_dirty_rect (display, x, y, w, h);
+}
+
+/*
+ * Stamp a sprite with its hot spot at (x, y). Clipping is done once
+ * for the whole sprite, and only its bounding box is marked dirty.
+ */
+static inline void
+sprite_blit (display_t *display, int x, int y, const struct sprite *sprite)
+{
+  int j;
+  int i0 = 0, j0 = 0;
+  int i1 = sprite->width, j1 = sprite->height;
+  const Uint32 *src;
+  Uint32 *dst;
+
+  if (display->tiles != NULL)
+  {
+    tile_record_sprite (display, x, y, sprite);
+    return;
+  }
+
+  x -= sprite->hot_x;
+  y -= sprite->hot_y;
+
+  if (x < display->clip_x1)
+    i0 = display->clip_x1 - x;
+
+  if (y < display->clip_y1)
+    j0 = display->clip_y1 - y;
+
+  if (x + i1 > display->clip_x2)
+    i1 = display->clip_x2 - x;
+
+  if (y + j1 > display->clip_y2)
+    j1 = display->clip_y2 - y;
+
+  if (i0 >= i1 || j0 >= j1)
+    return;
+
+  for (j = j0; j < j1; j++)
+  {
+    src = sprite->pixels + j * sprite->width;
+    dst = (Uint32 *) display->screen->pixels + x + (y + j) * display->width;
+
+    blend_span_pixels (dst + i0, src + i0, i1 - i0);
+  }
+
+  __make_dirty_rect (display, x + i0, y + j0, i1 - i0, j1 - j0);
+}
+
+/* Opaque copy of a sprite, for backgrounds saved with sprite_grab */
+static inline void
+sprite_put (display_t *display, int x, int y, const struct sprite *sprite)
+{
+  blit (display,
+        x - sprite->hot_x,
+        y - sprite->hot_y,
+        sprite->width,
+        sprite->height,
+        sprite->pixels,
+        sprite->width);
+}
+
 static inline void
 clear (display_t *display, Uint32 color)
 {
-  int i, j;
-  
-  for (j = 0; j < display->height; j++)
-    for (i = 0; i < display->width; i++)
-      pset_abs (display, i, j, color);
+  rect_fill (display, 0, 0, display->width, display->height, color);
+}
+
+/*
+ * Minor axis offset of step t of a line dmaj steps long along its major
+ * axis. It is stepped from both ends at once, so it is symmetric about
+ * the middle; from the start, step i is i * dmin / dmaj rounded half up.
+ */
+static inline int
+__line_offset (int t, int dmaj, int dmin)
+{
+  if (2 * t <= dmaj)
+    return (2 * (long long) t * dmin + dmaj) / (2 * dmaj);
+
+  return dmin - (2 * (long long) (dmaj - t) * dmin + dmaj) / (2 * dmaj);
+}
+
+static inline void
+__line_plot (display_t *display, Uint32 *p, Uint32 color)
+{
+  if (G_ALPHA (color) == 255)
+    *p = color & COLOR_MASK;
+  else
+    *p = alphacolor (display, *p, color);
 }
 
+/*
+ * Bresenham line, drawn the same as if the whole of it was visible and
+ * then clipped. The steps along the major axis that fall inside the clip
+ * rectangle are found directly, and since the minor offset never goes
+ * back, the ones also inside along the minor axis are found by
+ * bisection. The pixel pointer is then stepped by 1 and by the pitch,
+ * starting with the error term the full line would have had there.
+ * Axis aligned lines don't include their last pixel.
+ */
 static inline void 
 line (display_t *display, int x1, int y1, int x2, int y2, Uint32 color)
 {
-  int dx, dy, dx2, dy2;
-  int sx, sy;
-  int i, l;
-  int e;
+  Uint32 *p;
+  int dmaj, dmin;
+  int a, b, sa, sb;
+  int amin, amax, bmin, bmax;
+  int step_a, step_b;
+  int t, t0, t1, mid, lo, hi;
+  int olo, ohi;
+  int i, k, e;
+  int xmajor;
+
+  if (!G_ALPHA (color))
+    return;
+
+  if (display->tiles != NULL)
+  {
+    tile_record_line (display, x1, y1, x2, y2, color);
+    return;
+  }
+
+  if (y1 == y2)
+  {
+    if (x1 < x2)
+      hline_fill (display, x1, x2 - 1, y1, color);
+    else if (x1 > x2)
+      hline_fill (display, x2, x1 - 1, y1, color);
 
-  if ( (x1 < 0) | (display->screen->w <= x1) |
-       (x2 < 0) | (display->screen->w <= x2) |
-       (y1 < 0) | (display->screen->h <= y1) |
-       (y2 < 0) | (display->screen->h <= y2))
     return;
+  }
 
   if (SDL_MUSTLOCK (display->screen))
     if (SDL_LockSurface (display->screen) < 0)
       return;
 
-  dx = x2 - x1 < 0 ? x1 - x2 : x2 - x1;
-  dy = y2 - y1 < 0 ? y1 - y2 : y2 - y1;
-  sx = x2 - x1 < 0 ? -1 : 1;
-  sy = y2 - y1 < 0 ? -1 : 1;
-  
-  dx2 = dx << 1;
-  dy2 = dy << 1;
-
   if (x1 == x2)
   {
-    if (y1 < y2)
-    {
-      for (i = y1;i < y2;i++)
-      {
-        pset_abs (display, x1, i, color);
-      }
-    }
-    else{
-      for (i = y2;i < y1;i++)
-      {
-        pset_abs (display, x1, i, color);
-      }
-    }
+    i = y1 < y2 ? y1 : y2;
+    k = (y1 < y2 ? y2 : y1) - 1;
+
+    if (i < display->clip_y1)
+      i = display->clip_y1;
+
+    if (k >= display->clip_y2)
+      k = display->clip_y2 - 1;
+
+    if (x1 < display->clip_x1 || x1 >= display->clip_x2 || i > k)
+      goto done;
+
+    __make_dirty_rect (display, x1, i, 1, k - i + 1);
+
+    p = (Uint32 *) display->screen->pixels + x1 + i * display->width;
+
+    for (; i <= k; i++, p += display->width)
+      __line_plot (display, p, color);
+
+    goto done;
+  }
+
+  /* Walk along the axis that changes most */
+  xmajor = (x2 > x1 ? x2 - x1 : x1 - x2) >= (y2 > y1 ? y2 - y1 : y1 - y2);
+
+  if (xmajor)
+  {
+    a = x1; sa = x2 > x1 ? 1 : -1; dmaj = (x2 - x1) * sa;
+    b = y1; sb = y2 > y1 ? 1 : -1; dmin = (y2 - y1) * sb;
+    amin = display->clip_x1; amax = display->clip_x2 - 1;
+    bmin = display->clip_y1; bmax = display->clip_y2 - 1;
+    step_a = sa;
+    step_b = sb * display->width;
   }
-  else if (y1 == y2)
+  else
   {
-    if (x1 < x2)
+    a = y1; sa = y2 > y1 ? 1 : -1; dmaj = (y2 - y1) * sa;
+    b = x1; sb = x2 > x1 ? 1 : -1; dmin = (x2 - x1) * sb;
+    amin = display->clip_y1; amax = display->clip_y2 - 1;
+    bmin = display->clip_x1; bmax = display->clip_x2 - 1;
+    step_a = sa * display->width;
+    step_b = sb;
+  }
+
+  /* Steps inside along the major axis */
+  if (sa > 0)
+  {
+    t0 = amin - a > 0 ? amin - a : 0;
+    t1 = amax - a < dmaj ? amax - a : dmaj;
+  }
+  else
+  {
+    t0 = a - amax > 0 ? a - amax : 0;
+    t1 = a - amin < dmaj ? a - amin : dmaj;
+  }
+
+  /* Minor offsets inside */
+  olo = sb > 0 ? bmin - b : b - bmax;
+  ohi = sb > 0 ? bmax - b : b - bmin;
+
+  if (t0 <= t1 && __line_offset (t0, dmaj, dmin) < olo)
+  {
+    for (lo = t0, hi = t1 + 1; lo < hi; )
+      if (__line_offset (mid = (lo + hi) >> 1, dmaj, dmin) < olo)
+        lo = mid + 1;
+      else
+        hi = mid;
+
+    t0 = lo;
+  }
+
+  if (t0 <= t1 && __line_offset (t1, dmaj, dmin) > ohi)
+  {
+    for (lo = t0, hi = t1 + 1; lo < hi; )
+      if (__line_offset (mid = (lo + hi) >> 1, dmaj, dmin) <= ohi)
+        lo = mid + 1;
+      else
+        hi = mid;
+
+    t1 = lo - 1;
+  }
+
+  if (t0 > t1)
+    goto done;
+
+  /* Bounding box of what is left, marked once */
+  i = __line_offset (t0, dmaj, dmin);
+  k = __line_offset (t1, dmaj, dmin);
+  lo = sa > 0 ? a + t0 : a - t1; /* Lowest major coordinate */
+  hi = sb > 0 ? b + i : b - k;   /* Lowest minor coordinate */
+
+  if (xmajor)
+    __make_dirty_rect (display, lo, hi, t1 - t0 + 1, k - i + 1);
+  else
+    __make_dirty_rect (display, hi, lo, k - i + 1, t1 - t0 + 1);
+
+  /* First half, stepped from the start: e in [-2 dmaj, 0) */
+  mid = dmaj >> 1;
+  t = t0;
+
+  if (t <= mid)
+  {
+    k = __line_offset (t, dmaj, dmin);
+    e = -dmaj + (int) (2 * (long long) t * dmin - 2 * (long long) k * dmaj);
+    p = (Uint32 *) display->screen->pixels
+      + (xmajor
+         ? a + sa * t + (b + sb * k) * display->width
+         : b + sb * k + (a + sa * t) * display->width);
+
+    for (; t <= t1 && t <= mid; t++)
     {
-      for (i = x1;i < x2;i++)
-      {
-        pset_abs (display, i, y1, color);
-      }
-    }
-    else{
-      for (i = x2;i < x1;i++)
+      __line_plot (display, p, color);
+
+      p += step_a;
+
+      if ((e += 2 * dmin) >= 0)
       {
-        pset_abs (display, i, y1, color);
+        p += step_b;
+        e -= 2 * dmaj;
       }
     }
   }
-  else if (dx >= dy)
+
+  /* Second half, mirrored: stepped back from the end */
+  if (t <= t1)
   {
-    e = -dx;
-    l = (dx + 1) >> 1;
-    
-    for (i = 0;i < l;i++)
+    i = dmaj - t;
+    k = (2 * (long long) i * dmin + dmaj) / (2 * dmaj);
+    e = -dmaj + (int) (2 * (long long) i * dmin - 2 * (long long) k * dmaj);
+    p = (Uint32 *) display->screen->pixels
+      + (xmajor
+         ? a + sa * t + (b + sb * (dmin - k)) * display->width
+         : b + sb * (dmin - k) + (a + sa * t) * display->width);
+
+    for (; t <= t1; t++)
     {
-      pset_abs (display, x1, y1, color);
-      pset_abs (display, x2, y2, color);
-      x1 += sx;
-      x2 -= sx;
-      e += dy2;
-      if (e >= 0)
+      __line_plot (display, p, color);
+
+      p += step_a;
+
+      if ((e -= 2 * dmin) < -2 * dmaj)
       {
-        y1 += sy;
-        y2 -= sy;
-        e -= dx2;
+        p += step_b;
+        e += 2 * dmaj;
       }
     }
-    if (!(dx & 1))
-      pset_abs (display, x1, y1, color);
   }
-  else
+
+done:
+  if (SDL_MUSTLOCK (display->screen))
+    SDL_UnlockSurface (display->screen);
+}
+
+/*
+ * Trace through (x + i, y + ys[i]), i = 0 ... n - 1, as the lines
+ * between consecutive points would draw it, but one vertical span per
+ * column: the half of the segment on its left and the half on its right.
+ * Values are clamped to [0, h - 1], and segments with both ends out of
+ * that range are skipped.
+ */
+static inline void
+polyline_y (display_t *display, int x, int y, const int *ys, int n, int h,
+            Uint32 color)
+{
+  Uint32 *p;
+  int i, j, top, bottom, len;
+  int cur, prev = 0, next = 0;
+  int vis_prev = 0, vis_next;
+  int x1 = display->clip_x2, x2 = display->clip_x1 - 1;
+  int y1 = display->clip_y2, y2 = display->clip_y1 - 1;
+
+  if (!G_ALPHA (color) || n <= 0 || h <= 0)
+    return;
+
+  if (display->tiles != NULL)
   {
-    e = -dy;
-    l = (dy + 1) >> 1;
-    
-    for (i = 0; i < l;i++)
+    tile_record_polyline (display, x, y, ys, n, h, color);
+    return;
+  }
+
+  if (SDL_MUSTLOCK (display->screen))
+    if (SDL_LockSurface (display->screen) < 0)
+      return;
+
+  cur = ys[0] < 0 ? 0 : (ys[0] >= h ? h - 1 : ys[0]);
+
+  for (i = 0; i < n; i++, prev = cur, cur = next, vis_prev = vis_next)
+  {
+    vis_next = 0;
+
+    if (i + 1 < n)
     {
-      pset_abs (display, x1, y1, color);
-      pset_abs (display, x2, y2, color);
-      y1 += sy;
-      y2 -= sy;
-      e += dx2;
-      
-      if (e >= 0)
-      {
-        x1 += sx;
-        x2 -= sx;
-        e -= dy2;
-      }
+      vis_next = (ys[i] >= 0 && ys[i] < h) || (ys[i + 1] >= 0 && ys[i + 1] < h);
+      next = ys[i + 1] < 0 ? 0 : (ys[i + 1] >= h ? h - 1 : ys[i + 1]);
+    }
+
+    top = h;
+    bottom = -1;
+
+    /* Left segment: from cur, ceil (d / 2) pixels towards prev */
+    if (vis_prev && prev != cur)
+    {
+      len = ((prev > cur ? prev - cur : cur - prev) + 1) >> 1;
+
+      top    = prev < cur ? cur - len + 1 : cur;
+      bottom = prev < cur ? cur : cur + len - 1;
     }
-    if (!(dy & 1))
-      pset_abs (display, x1, y1, color);
+
+    /* Right segment: from cur, floor (d / 2) + 1 pixels towards next */
+    if (vis_next)
+    {
+      len = (next > cur ? next - cur : cur - next) / 2 + 1;
+
+      j = next < cur ? cur - len + 1 : cur;
+      if (j < top)
+        top = j;
+
+      j = next < cur ? cur : cur + len - 1;
+      if (j > bottom)
+        bottom = j;
+    }
+
+    if (top > bottom
+        || x + i < display->clip_x1 || x + i >= display->clip_x2)
+      continue;
+
+    top += y;
+    bottom += y;
+
+    if (top < display->clip_y1)
+      top = display->clip_y1;
+
+    if (bottom >= display->clip_y2)
+      bottom = display->clip_y2 - 1;
+
+    if (top > bottom)
+      continue;
+
+    p = (Uint32 *) display->screen->pixels + x + i + top * display->width;
+
+    for (j = top; j <= bottom; j++, p += display->width)
+      __line_plot (display, p, color);
+
+    if (x + i < x1)
+      x1 = x + i;
+
+    x2 = x + i;
+
+    if (top < y1)
+      y1 = top;
+
+    if (bottom > y2)
+      y2 = bottom;
   }
 
+  if (x1 <= x2)
+    __make_dirty_rect (display, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+
   if (SDL_MUSTLOCK (display->screen))
     SDL_UnlockSurface (display->screen);
 }
 
-
 static inline void
 box (display_t *display, int x1, int y1, int x2, int y2, Uint32 color)
 {
@@ -300,17 +867,13 @@ swap (int *x, int *y)
 static inline void
 fbox (display_t *display, int x1, int y1, int x2, int y2, Uint32 color)
 {
-  int i, j;
-  
   if (x1 > x2)
     swap (&x1, &x2);
   
   if (y1 > y2)
     swap (&y1, &y2);
   
-  for (j = y1; j <= y2; j++)
-    for (i = x1; i <= x2; i++)
-      pset_abs (display, i, j, color); 
+  rect_fill (display, x1, y1, x2 - x1 + 1, y2 - y1 + 1, color);
 }
 
 static inline void 
@@ -0,0 +1,205 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <util.h>
+
+#include "draw.h"
+
+#ifdef HAVE_SDL2
+
+/*
+ * SDL2 backend. Drawing goes to a framebuffer in memory as usual; on
+ * refresh only the dirty rectangles are uploaded to a streaming texture,
+ * which is then presented. With a vsync renderer the present blocks
+ * until the next monitor refresh, so that paces the frames. The
+ * software renderer has no vsync, and presents are spaced one refresh
+ * period apart by hand instead.
+ */
+
+#define SDL2_ALIGN           64
+#define SDL2_DEFAULT_REFRESH 60 /* Hz, if the display mode doesn't say */
+
+struct sdl2_data
+{
+  SDL_Window   *window;
+  SDL_Renderer *renderer;
+  SDL_Texture  *texture;
+  Uint32       *pixels;
+
+  int    vsync;
+  Uint32 period;       /* ms between presents without vsync */
+  Uint32 last_present; /* SDL_GetTicks */
+};
+
+static int
+sdl2_open (display_t *display)
+{
+  struct sdl2_data *data;
+  SDL_RendererInfo info;
+  SDL_DisplayMode mode;
+
+  if (sdl_init () == -1)
+    return -1;
+
+  data = xmalloc (sizeof (struct sdl2_data));
+
+  memset (data, 0, sizeof (struct sdl2_data));
+
+  if ((data->window = SDL_CreateWindow (
+      "libsim: simulation window",
+      SDL_WINDOWPOS_UNDEFINED,
+      SDL_WINDOWPOS_UNDEFINED,
+      display->width,
+      display->height,
+      0)) == NULL)
+  {
+    ERROR ("Unable to create window: %s\n", SDL_GetError ());
+    goto fail;
+  }
+
+  if ((data->renderer = SDL_CreateRenderer (
+      data->window,
+      -1,
+      SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC)) == NULL)
+  {
+    fprintf (stderr,
+      "display_new: can't use accelerated renderer, trying software\n");
+
+    if ((data->renderer = SDL_CreateRenderer (
+        data->window,
+        -1,
+        SDL_RENDERER_SOFTWARE)) == NULL)
+    {
+      ERROR ("Unable to create renderer: %s\n", SDL_GetError ());
+      goto fail;
+    }
+  }
+
+  if (SDL_GetRendererInfo (data->renderer, &info) == 0)
+    data->vsync = !!(info.flags & SDL_RENDERER_PRESENTVSYNC);
+
+  if (SDL_GetWindowDisplayMode (data->window, &mode) == 0
+      && mode.refresh_rate > 0)
+    data->period = 1000 / mode.refresh_rate;
+  else
+    data->period = 1000 / SDL2_DEFAULT_REFRESH;
+
+  /* The alpha byte of the screen is garbage, so no alpha in the format */
+  if ((data->texture = SDL_CreateTexture (
+      data->renderer,
+      SDL_PIXELFORMAT_RGB888,
+      SDL_TEXTUREACCESS_STREAMING,
+      display->width,
+      display->height)) == NULL)
+  {
+    ERROR ("Unable to create texture: %s\n", SDL_GetError ());
+    goto fail;
+  }
+
+  if (posix_memalign (
+      (void **) &data->pixels,
+      SDL2_ALIGN,
+      display->width * display->height * sizeof (Uint32)) != 0)
+  {
+    ERROR ("sdl2_open: cannot allocate framebuffer\n");
+    data->pixels = NULL;
+    goto fail;
+  }
+
+  if ((display->screen = SDL_CreateRGBSurfaceFrom (
+      data->pixels,
+      display->width,
+      display->height,
+      32,
+      display->width * sizeof (Uint32),
+      0xff0000,
+      0x00ff00,
+      0x0000ff,
+      0)) == NULL)
+  {
+    ERROR ("Unable to create surface: %s\n", SDL_GetError ());
+    goto fail;
+  }
+
+  display->backend_data = data;
+
+  return 0;
+
+fail:
+  if (data->pixels != NULL)
+    free (data->pixels);
+
+  if (data->texture != NULL)
+    SDL_DestroyTexture (data->texture);
+
+  if (data->renderer != NULL)
+    SDL_DestroyRenderer (data->renderer);
+
+  if (data->window != NULL)
+    SDL_DestroyWindow (data->window);
+
+  free (data);
+
+  return -1;
+}
+
+static void
+sdl2_update (display_t *display, int count, SDL_Rect *rects)
+{
+  struct sdl2_data *data = display->backend_data;
+  Uint32 elapsed;
+  int i;
+
+  for (i = 0; i < count; i++)
+    SDL_UpdateTexture (
+      data->texture,
+      rects + i,
+      data->pixels + rects[i].x + rects[i].y * display->width,
+      display->width * sizeof (Uint32));
+
+  if (!data->vsync)
+  {
+    elapsed = SDL_GetTicks () - data->last_present;
+
+    if (elapsed < data->period)
+      SDL_Delay (data->period - elapsed);
+  }
+
+  /* The back buffer is undefined after a present, copy all of it */
+  SDL_RenderCopy (data->renderer, data->texture, NULL, NULL);
+  SDL_RenderPresent (data->renderer);
+
+  data->last_present = SDL_GetTicks ();
+}
+
+const struct display_backend display_sdl2_backend =
+{
+  "sdl2",
+  sdl2_open,
+  sdl2_update,
+  sdl_poll_events,
+  sdl_wait_events,
+  sdl_break_wait,
+  NULL
+};
+
+#endif /* HAVE_SDL2 */
@@ -0,0 +1,114 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "draw.h"
+
+#include <util.h>
+
+struct sprite *
+sprite_new (int width, int height, int hot_x, int hot_y)
+{
+  struct sprite *new;
+
+  new = xmalloc (sizeof (struct sprite));
+
+  new->width  = width;
+  new->height = height;
+  new->hot_x  = hot_x;
+  new->hot_y  = hot_y;
+  new->pixels = xmalloc (width * height * sizeof (Uint32));
+
+  memset (new->pixels, 0, width * height * sizeof (Uint32));
+
+  return new;
+}
+
+/* Coordinates relative to the hot spot, both ends included */
+static void
+sprite_hline (struct sprite *sprite, int x1, int x2, int y, Uint32 color)
+{
+  for (; x1 <= x2; x1++)
+    sprite->pixels[sprite->hot_x + x1 + (sprite->hot_y + y) * sprite->width] =
+      color;
+}
+
+static void
+sprite_vline (struct sprite *sprite, int x, int y1, int y2, Uint32 color)
+{
+  for (; y1 <= y2; y1++)
+    sprite->pixels[sprite->hot_x + x + (sprite->hot_y + y1) * sprite->width] =
+      color;
+}
+
+/*
+ * Same shape as mark (): a cross of col1 with a col2 outline. Each
+ * pixel gets a single color, where mark () blends the overlapping
+ * lines twice.
+ */
+struct sprite *
+sprite_new_mark (int size, Uint32 col1, Uint32 col2)
+{
+  struct sprite *new;
+
+  new = sprite_new (2 * size + 3, 2 * size + 3, size + 1, size + 1);
+
+  sprite_vline (new,  0, -size - 1, size + 1, col2);
+  sprite_vline (new, -1, -size, size, col2);
+  sprite_vline (new,  1, -size, size, col2);
+  sprite_hline (new, -size - 1, size + 1,  0, col2);
+  sprite_hline (new, -size, size, -1, col2);
+  sprite_hline (new, -size, size,  1, col2);
+
+  sprite_vline (new, 0, -size, size, col1);
+  sprite_hline (new, -size, size, 0, col1);
+
+  return new;
+}
+
+/*
+ * Save a block of the screen. Pixels are stored as they are in the
+ * framebuffer (alpha is not set), so the result is meant to be drawn
+ * back with sprite_put. Parts outside the screen are left black.
+ */
+struct sprite *
+sprite_grab (display_t *display, int x, int y, int w, int h)
+{
+  struct sprite *new;
+  int i, j;
+
+  new = sprite_new (w, h, 0, 0);
+
+  display_sync (display);
+
+  for (j = 0; j < h; j++)
+    for (i = 0; i < w; i++)
+      new->pixels[i + j * w] = pget (display, x + i, y + j);
+
+  return new;
+}
+
+void
+sprite_free (struct sprite *sprite)
+{
+  free (sprite->pixels);
+  free (sprite);
+}
@@ -32,12 +32,200 @@
 #define DEFAULT_FONT_SIZE 8
 #define DEFAULT_CODEPAGE  850
 
+#define TEXT_CACHE_ENTRIES 64  /* Labels remembered per display */
+#define TEXT_PRINTF_BUFSIZ 256 /* display_printf text that needs no malloc */
+#define TEXTAREA_RUN       64  /* Characters of a text area drawn at once */
+
+/*
+ * Text cache. Labels are usually redrawn every frame, at the same
+ * place and mostly with the same text. Every entry remembers a label
+ * and the pixels left under each of its characters. Drawing a
+ * character again over those pixels would leave them as they are. So
+ * a cell is only drawn, and marked dirty, if its character changed or
+ * something else was drawn over it. Entries are keyed by position,
+ * font and colors, and the least recently used one is replaced.
+ */
+struct text_cache_entry
+{
+  struct cpi_disp_font *font;
+  int x, y;
+  Uint32 color, bgcolor;
+  
+  char *text;
+  int len;           /* Characters drawn, after cutting at the screen edge */
+  int rows;
+  int size;          /* Characters text and pixels have room for */
+  Uint32 *pixels;    /* Cell after cell, 8 x rows pixels each */
+  unsigned int used; /* Last lookup, for LRU */
+};
+
+struct text_cache
+{
+  struct text_cache_entry entries[TEXT_CACHE_ENTRIES];
+  int count;
+  unsigned int clock;
+};
+
 int
 have_font_selected (display_t *display)
 {
   return display->cpi_selected && display->selected_font;
 }
 
+static void
+text_draw (display_t *display, struct cpi_disp_font *font,
+           int x, int y, int color, int bgcolor, const char *text)
+{
+  struct glyph_atlas *atlas;
+  
+  if ((atlas = glyph_atlas_get (font, color, bgcolor)) != NULL)
+    glyph_atlas_puts (display, atlas, x, y, text);
+  else
+    cpi_puts (font, display->width, display->height, x, y, 
+      display->screen->pixels, 4, !(bgcolor & 0xff000000), color, bgcolor, text);
+}
+
+static struct text_cache_entry *
+text_cache_lookup (display_t *display, 
+                   int x, int y, int color, int bgcolor)
+{
+  struct text_cache *cache;
+  struct text_cache_entry *entry, *victim;
+  int i;
+  
+  if ((cache = display->text_cache) == NULL)
+  {
+    cache = display->text_cache = xmalloc (sizeof (struct text_cache));
+    
+    memset (cache, 0, sizeof (struct text_cache));
+  }
+  
+  cache->clock++;
+  
+  victim = NULL;
+  
+  for (i = 0; i < cache->count; i++)
+  {
+    entry = cache->entries + i;
+    
+    if (entry->x == x && entry->y == y && 
+        entry->font == display->selected_font &&
+        entry->color == color && entry->bgcolor == bgcolor)
+    {
+      entry->used = cache->clock;
+      return entry;
+    }
+    
+    if (victim == NULL || entry->used < victim->used)
+      victim = entry;
+  }
+  
+  if (cache->count < TEXT_CACHE_ENTRIES)
+    victim = cache->entries + cache->count++;
+  
+  /* Buffers are reallocated, as rows may change */
+  victim->font    = display->selected_font;
+  victim->x       = x;
+  victim->y       = y;
+  victim->color   = color;
+  victim->bgcolor = bgcolor;
+  victim->len     = 0;
+  victim->size    = 0;
+  victim->used    = cache->clock;
+  
+  victim->rows = victim->font->rows;
+  
+  if (victim->rows + y > display->height)
+    victim->rows = display->height - y;
+  
+  return victim;
+}
+
+static inline int
+text_cell_intact (display_t *display, const struct text_cache_entry *entry,
+                  int n)
+{
+  Uint32 *pixels = display->screen->pixels;
+  int j;
+  
+  for (j = 0; j < entry->rows; j++)
+    if (memcmp (
+        pixels + entry->x + 8 * n + (entry->y + j) * display->width,
+        entry->pixels + (n * entry->rows + j) * 8,
+        8 * sizeof (Uint32)) != 0)
+      return 0;
+  
+  return 1;
+}
+
+static void
+text_cache_puts (display_t *display, 
+                 int x, int y, int color, int bgcolor, const char *text)
+{
+  struct text_cache_entry *entry;
+  Uint32 *pixels = display->screen->pixels;
+  int first, last;
+  int len;
+  int j, n;
+  
+  /* Cells are compared and saved whole, they must be on the screen */
+  if (x < 0 || y < 0 || x >= display->width || y >= display->height)
+    return;
+  
+  /* Same cut as cpi_puts */
+  len = strlen (text);
+  
+  if (8 * len + x > display->width)
+    len = (display->width - x) / 8;
+  
+  if (len <= 0)
+    return;
+  
+  entry = text_cache_lookup (display, x, y, color, bgcolor);
+  
+  first = last = -1;
+  
+  for (n = 0; n < len; n++)
+    if (n >= entry->len || entry->text[n] != text[n] || 
+        !text_cell_intact (display, entry, n))
+    {
+      if (first == -1)
+        first = n;
+      
+      last = n;
+    }
+  
+  if (len >= entry->size)
+  {
+    entry->size   = len + 1;
+    entry->text   = xrealloc (entry->text, entry->size);
+    entry->pixels = xrealloc (entry->pixels, 
+      entry->size * 8 * entry->rows * sizeof (Uint32));
+  }
+  
+  memcpy (entry->text, text, len);
+  entry->len = len;
+  
+  if (first == -1)
+    return;
+  
+  /* Draw the changed span only */
+  entry->text[last + 1] = '\0';
+  text_draw (display, entry->font, 
+    x + 8 * first, y, color, bgcolor, entry->text + first);
+  entry->text[last + 1] = text[last + 1];
+  
+  for (n = first; n <= last; n++)
+    for (j = 0; j < entry->rows; j++)
+      memcpy (
+        entry->pixels + (n * entry->rows + j) * 8,
+        pixels + x + 8 * n + (y + j) * display->width,
+        8 * sizeof (Uint32));
+  
+  __make_dirty_rect (display, 
+    x + 8 * first, y, 8 * (last - first + 1), entry->rows);
+}
+
 void 
 display_puts (display_t *display, 
              int x, int y, int color, int bgcolor, const char *text)
@@ -50,12 +238,14 @@ display_puts (display_t *display,
 
   if (x < 0 || y < 0 || x >= display->width || y >= display->height)
     return;
-    
-  cpi_puts (display->selected_font, display->width, display->height, x, y, 
-      display->screen->pixels, 4, !(bgcolor & 0xff000000), color, bgcolor, text);
-  __make_dirty (display, x, y);
-  __make_dirty (display, 
-    x + 8 * strlen (text) - 1, y + display->selected_font->rows - 1);
+  
+  if (display->tiles != NULL)
+  {
+    tile_record_text (display, x, y, color, bgcolor, text);
+    return;
+  }
+  
+  text_cache_puts (display, x, y, color, bgcolor, text);
 }
 
 void 
@@ -63,7 +253,9 @@ display_printf (display_t *display,
                int x, int y, int color, int bgcolor, const char *fmt, ...)
 {
   va_list ap;
+  char buf[TEXT_PRINTF_BUFSIZ];
   char *text;
+  int size;
   
   if (!have_font_selected (display))
   {
@@ -72,6 +264,21 @@ display_printf (display_t *display,
   }
   
   
+  va_start (ap, fmt);
+  
+  size = vsnprintf (buf, sizeof (buf), fmt, ap);
+  
+  va_end (ap);
+  
+  if (size < 0)
+    return;
+  
+  if (size < sizeof (buf))
+  {
+    display_puts (display, x, y, color, bgcolor, buf);
+    return;
+  }
+  
   va_start (ap, fmt);
   
   text = vstrbuild (fmt, ap);
@@ -85,9 +292,13 @@ display_printf (display_t *display,
 int
 display_select_cpi (display_t *display, const char *path)
 {
-  /* What if there's another CPI file selected */
-  if (cpi_map_codepage (&display->cpi_handle, path) == -1)
+  struct cpi_file *file;
+  
+  /* Fonts of the previous file stay mapped, as all CPI files do */
+  if ((file = cpi_open (path)) == NULL)
     return -1;
+  
+  display->cpi_file = file;
   display->cpi_selected = 1;
   
   return 0;
@@ -96,74 +307,64 @@ display_select_cpi (display_t *display, const char *path)
 int
 display_select_font (display_t *display, int cp, int height)
 {
-  struct cpi_entry *page;
-  
   if (!display->cpi_selected)
   {
     ERROR ("display_select_font: no CPI file selected\n");
     return -1;
   }
   
-  if ((page = cpi_get_page (&display->cpi_handle, cp)) == NULL)
-  {
-    ERROR ("display_select_font: codepage `%d' doesn't exit\n", cp);
-    return -1;
-  }
-  
   if ((display->selected_font = 
-       cpi_get_disp_font (&display->cpi_handle, page, height, 8)) == NULL)
+       cpi_find_font (display->cpi_file, cp, height, 8)) == NULL)
   {
-    ERROR ("display_select_font: font of %dx%d doesn't exit\n", height, 8);
+    ERROR ("display_select_font: no font of %dx%d for codepage `%d'\n", 
+      height, 8, cp);
     return -1;
   }
   
   return 0;
 }
 
+/*
+ * Text areas keep their text as a ring of character cells, cpi_height
+ * rows of cpi_width, which display_refresh draws. A scroll moves the
+ * first row of the ring and clears the one that comes in at the
+ * bottom, instead of moving pixels. The area also remembers what the
+ * screen shows, in screen order, so only cells that differ from it
+ * are drawn again.
+ */
+static inline struct text_cell *
+textarea_cell (textarea_t *area, int x, int y)
+{
+  return area->cells + 
+    ((area->top + y) % area->cpi_height) * area->cpi_width + x;
+}
+
+static inline int
+text_cell_equal (const struct text_cell *a, const struct text_cell *b)
+{
+  if (a->blank || b->blank)
+    return a->blank == b->blank;
+  
+  return a->c == b->c && a->color == b->color && a->bgcolor == b->bgcolor;
+}
 
 void 
 scroll_up (textarea_t *area)
 {
-  int i, j;
+  int i;
   
-  for (i = area->selected_font->rows; 
-       i < area->cpi_height * area->selected_font->rows; i++)
-    memcpy (
-      area->display->screen->pixels +
-        sizeof (Uint32) * (area->pos_x + 
-          (area->pos_y + i - area->selected_font->rows) 
-          * area->display->width),
-          
-      area->display->screen->pixels +
-        sizeof (Uint32) * (area->pos_x +
-          (area->pos_y + i) * area->display->width),
-            
-      (area->cpi_width * 8) * sizeof (Uint32));
-  
-  
-  for (j = 0; j < area->selected_font->rows; j++)
-    memset (
-      area->display->screen->pixels +
-        sizeof (Uint32) * (area->pos_x +
-          (area->pos_y + j + (area->cpi_height - 1) * area->selected_font->rows) 
-        * area->display->width),
-      0,
-      (area->cpi_width * 8) * sizeof (Uint32));
-            
-  __make_dirty (area->display, area->pos_x, area->pos_y);
-  __make_dirty (area->display, 
-    area->pos_x + area->cpi_width  * 8 - 1, 
-    area->pos_y + area->cpi_height * area->selected_font->rows - 1);
+  area->top = (area->top + 1) % area->cpi_height;
   
+  for (i = 0; i < area->cpi_width; i++)
+    textarea_cell (area, i, area->cpi_height - 1)->blank = 1;
+  
+  area->changed = 1;
 }
 
 static inline void 
-cputchar (textarea_t *area, char c)
+cputchar (textarea_t *area, char c, int color)
 {
-  char cbuf [2];
-  
-  cbuf[0] = c;
-  cbuf[1] = '\0';
+  struct text_cell *cell;
   
   if (c == '\n')
   {
@@ -192,25 +393,125 @@ cputchar (textarea_t *area, char c)
           scroll_up (area);
         }
       }
+    
+    cell = textarea_cell (area, area->cursor_x, area->cursor_y);
+    
+    cell->c       = c;
+    cell->color   = color;
+    cell->bgcolor = area->bgcolor;
+    cell->blank   = 0;
+    
+    area->changed = 1;
       
-    cpi_puts (area->selected_font, 
-      area->display->width, 
-      area->display->height, 
-      area->pos_x + area->cursor_x * 8, 
-      area->pos_y + area->selected_font->rows * (area->cursor_y), 
-      area->display->screen->pixels, 4, !(area->bgcolor & 0xff000000), area->color, area->bgcolor, cbuf);
+      area->cursor_x++;
+  }
+}
+
+/* Black, as the pixels a scroll used to bring in */
+static void
+textarea_clear_cell (display_t *display, int x, int y, int rows)
+{
+  Uint32 *pixels = display->screen->pixels;
+  int w = 8;
+  int j;
+  
+  if (x + w > display->width)
+    w = display->width - x;
+  
+  if (y + rows > display->height)
+    rows = display->height - y;
+  
+  for (j = 0; j < rows; j++)
+    memset (pixels + x + (y + j) * display->width, 0, w * sizeof (Uint32));
+}
+
+/* Draw the cells that changed since the last time, display_refresh calls it */
+void
+textarea_flush (textarea_t *area)
+{
+  display_t *display = area->display;
+  struct text_cell *cells, *cell, *shown;
+  char run[TEXTAREA_RUN + 1];
+  int run_x, run_len;
+  Uint32 run_color, run_bgcolor;
+  int rows = area->selected_font->rows;
+  int first, last;
+  int px, py;
+  int i, j;
+  
+  if (!area->changed)
+    return;
   
+  /* Text areas write the screen directly */
+  display_sync (display);
+  
+  run_color = run_bgcolor = 0;
+  
+  for (j = 0; j < area->cpi_height; j++)
+  {
+    py = area->pos_y + rows * j;
     
-    __make_dirty (area->display, 
-      area->pos_x + area->cursor_x * 8, 
-      area->pos_y + area->selected_font->rows * (area->cursor_y));
+    first = last = -1;
+    run_x = run_len = 0;
     
-    __make_dirty (area->display, 
-      area->pos_x + area->cursor_x * 8 + 7, 
-      area->pos_y + area->selected_font->rows * (area->cursor_y + 1) - 1);
+    cells = textarea_cell (area, 0, j);
+    shown = area->shown + j * area->cpi_width;
+    
+    for (i = 0; i <= area->cpi_width; i++, shown++)
+    {
+      cell = cells + i;
       
-      area->cursor_x++;
+      /* Adjacent characters in the same colors are drawn at once */
+      if (run_len > 0 && 
+          (i == area->cpi_width || run_x + run_len != i || 
+           run_len == TEXTAREA_RUN || cell->blank || 
+           cell->color != run_color || cell->bgcolor != run_bgcolor))
+      {
+        run[run_len] = '\0';
+        text_draw (display, area->selected_font, 
+          area->pos_x + 8 * run_x, py, run_color, run_bgcolor, run);
+        run_len = 0;
+      }
+      
+      if (i == area->cpi_width || text_cell_equal (cell, shown))
+        continue;
+      
+      px = area->pos_x + 8 * i;
+      
+      if (px < display->width && py < display->height)
+      {
+        /* A transparent glyph would land on the one shown */
+        if (cell->blank || 
+            (!shown->blank && !(cell->bgcolor & 0xff000000)))
+          textarea_clear_cell (display, px, py, rows);
+        
+        if (!cell->blank)
+        {
+          if (run_len == 0)
+          {
+            run_x       = i;
+            run_color   = cell->color;
+            run_bgcolor = cell->bgcolor;
+          }
+          
+          run[run_len++] = cell->c;
+        }
+      }
+      
+      *shown = *cell;
+      
+      if (first == -1)
+        first = i;
+      
+      last = i;
+    }
+    
+    if (first != -1)
+      __make_dirty_rect (display, 
+        area->pos_x + 8 * first, py, 8 * (last - first + 1), rows);
   }
+  
+  area->changed = 0;
 }
 
 void 
@@ -218,19 +519,52 @@ cputs (textarea_t *area, const char *text)
 {
   int i;
   
-  for (i = 0; i < strlen (text); i++)
-    cputchar (area, text[i]);
+  for (i = 0; text[i] != '\0'; i++)
+    cputchar (area, text[i], area->color);
     
   if (area->autorefresh)
     display_refresh (area->display);
 }
 
+/* 
+ * Append count symbols at once, each in its own color. If colors is
+ * NULL, the foreground color of the area is used.
+ */
+void
+textarea_put_symbols (textarea_t *area, 
+                      const char *symbols, const Uint32 *colors, int count)
+{
+  int i;
+  
+  for (i = 0; i < count; i++)
+    cputchar (area, symbols[i], colors != NULL ? colors[i] : area->color);
+  
+  if (area->autorefresh)
+    display_refresh (area->display);
+}
 
 void 
 cprintf (textarea_t *area, const char *fmt, ...)
 {
   va_list ap;
+  char buf[TEXT_PRINTF_BUFSIZ];
   char *text;
+  int size;
+  
+  va_start (ap, fmt);
+  
+  size = vsnprintf (buf, sizeof (buf), fmt, ap);
+  
+  va_end (ap);
+  
+  if (size < 0)
+    return;
+  
+  if (size < sizeof (buf))
+  {
+    cputs (area, buf);
+    return;
+  }
   
   va_start (ap, fmt);
   
@@ -249,7 +583,14 @@ display_textarea_new (display_t *disp, int x, int y, int cols, int rows,
   const char *path, int cp, int height)
 {
   textarea_t *new;
-  struct cpi_entry *page;
+  struct cpi_file *file;
+  int i;
+  
+  if ((file = cpi_open (path)) == NULL)
+  {
+    ERROR ("display_textarea_new: cpi_open failed\n");
+    return NULL;
+  }
   
   new = xmalloc (sizeof (textarea_t));
   
@@ -257,28 +598,11 @@ display_textarea_new (display_t *disp, int x, int y, int cols, int rows,
   
   new->display = disp;
   
-  /* What if there's another CPI file selected */
-  if (cpi_map_codepage (&new->cpi_handle, path) == -1)
-  {
-    ERROR ("display_textarea_new: cpi_map_codepage failed\n");
-    free (new);
-    return NULL;
-  }
-  
-  if ((page = cpi_get_page (&new->cpi_handle, cp)) == NULL)
+  if ((new->selected_font = cpi_find_font (file, cp, height, 8)) == NULL)
   {
-    ERROR ("display_textarea_new: cpi_get_page failed (no codepage %d)\n", cp);
+    ERROR ("display_textarea_new: no font of %dx%d for codepage %d\n", 
+      height, 8, cp);
     free (new);
-    cpi_unmap (&new->cpi_handle);
-    return NULL;
-  }
-  
-  if ((new->selected_font = 
-       cpi_get_disp_font (&new->cpi_handle, page, height, 8)) == NULL)
-  {
-    ERROR ("display_textarea_new: cpi_get_disp_font failed (no font of %dx%d)\n", height, 8);
-    free (new);
-    cpi_unmap (&new->cpi_handle);
     return NULL;
   }
   
@@ -294,6 +618,19 @@ display_textarea_new (display_t *disp, int x, int y, int cols, int rows,
   new->color = ARGB (0xff, 0xff, 0x7f, 0x00);
   new->bgcolor = 0x000000;
   
+  new->cells = xmalloc (cols * rows * sizeof (struct text_cell));
+  new->shown = xmalloc (cols * rows * sizeof (struct text_cell));
+  
+  memset (new->cells, 0, cols * rows * sizeof (struct text_cell));
+  memset (new->shown, 0, cols * rows * sizeof (struct text_cell));
+  
+  /* Nothing drawn yet, what is under the area stays */
+  for (i = 0; i < cols * rows; i++)
+    new->cells[i].blank = new->shown[i].blank = 1;
+  
+  new->next = disp->textareas;
+  disp->textareas = new;
+  
   return new;
 }
 
@@ -0,0 +1,597 @@
+/*
+ *    <one line to give the program's name and a brief idea of what it does.>
+ *    Copyright (C) <year>  <name of author>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <util.h>
+
+#include "draw.h"
+
+/*
+ * Tiled rendering. The screen is cut in DISPLAY_TILE_SIZE squares and
+ * every recorded command is put in the bin of each tile its bounding
+ * box touches. display_sync hands the tiles out to a pool of threads
+ * (the caller being one of them); each replays its bin in order with
+ * the clip rectangle set to the tile, so no two threads ever write the
+ * same pixel and the result is the same as drawing serially.
+ */
+
+enum tile_cmd_type
+{
+  TILE_CMD_PSET,
+  TILE_CMD_LINE,
+  TILE_CMD_RECT,
+  TILE_CMD_BLIT,
+  TILE_CMD_SPRITE,
+  TILE_CMD_TEXT,
+  TILE_CMD_POLYLINE
+};
+
+struct tile_cmd
+{
+  enum tile_cmd_type type;
+  int x, y, w, h;     /* Bounding box, what the command is binned by */
+  int x1, y1, x2, y2; /* Line end points, or where to draw */
+  int n;              /* Polyline values */
+  Uint32 color, bgcolor;
+  const struct sprite *sprite;
+  struct cpi_disp_font *font;
+  const struct glyph_atlas *atlas; /* NULL if text is plotted bit by bit */
+  void *copy;         /* Pixels, text or values, owned by the queue */
+};
+
+struct tile_bin
+{
+  int *cmds;
+  int count;
+  int size;
+};
+
+struct tile_queue
+{
+  display_t *display;
+
+  struct tile_cmd *cmds;
+  int count;
+  int size;
+
+  int cols, rows;
+  struct tile_bin *bins;
+
+  pthread_t *threads;
+  int thread_count;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  start;
+  pthread_cond_t  done;
+  unsigned int generation; /* Bumped every time a sync starts */
+  int next_tile;
+  int busy;                /* Workers still rasterizing this sync */
+  int quit;
+};
+
+static void
+tile_puts (display_t *display, const struct tile_cmd *cmd)
+{
+  struct glyph *glyph;
+  const char *text = cmd->copy;
+  Uint32 *pixels = display->screen->pixels;
+  int transpbg = !(cmd->bgcolor & 0xff000000);
+  int len, rows;
+  int i, j, n, x, y;
+
+  if (cmd->atlas != NULL)
+  {
+    glyph_atlas_puts (display, cmd->atlas, cmd->x1, cmd->y1, text);
+    return;
+  }
+
+  /* Same truncation as cpi_puts against the whole screen */
+  len = strlen (text);
+
+  if (8 * len + cmd->x1 > display->width)
+    len = (display->width - cmd->x1) / 8;
+
+  rows = cmd->font->rows;
+
+  if (rows + cmd->y1 > display->height)
+    rows = display->height - cmd->y1;
+
+  for (n = 0; n < len; n++)
+  {
+    if ((glyph = cpi_get_glyph (cmd->font, (unsigned char) text[n])) == NULL)
+      continue;
+
+    for (j = 0; j < rows; j++)
+    {
+      y = cmd->y1 + j;
+
+      if (y < display->clip_y1 || y >= display->clip_y2)
+        continue;
+
+      for (i = 0; i < 8; i++)
+      {
+        x = cmd->x1 + n * 8 + i;
+
+        if (x < display->clip_x1 || x >= display->clip_x2)
+          continue;
+
+        if (glyph->bits[j] & (1 << (7 - i)))
+          pixels[x + y * display->width] = cmd->color;
+        else if (!transpbg)
+          pixels[x + y * display->width] = cmd->bgcolor;
+      }
+    }
+  }
+}
+
+static void
+tile_replay (display_t *display, const struct tile_cmd *cmd)
+{
+  switch (cmd->type)
+  {
+    case TILE_CMD_PSET:
+      pset_abs (display, cmd->x1, cmd->y1, cmd->color);
+      break;
+
+    case TILE_CMD_LINE:
+      line (display, cmd->x1, cmd->y1, cmd->x2, cmd->y2, cmd->color);
+      break;
+
+    case TILE_CMD_RECT:
+      rect_fill (display, cmd->x, cmd->y, cmd->w, cmd->h, cmd->color);
+      break;
+
+    case TILE_CMD_BLIT:
+      blit (display, cmd->x, cmd->y, cmd->w, cmd->h, cmd->copy, cmd->w);
+      break;
+
+    case TILE_CMD_SPRITE:
+      sprite_blit (display, cmd->x1, cmd->y1, cmd->sprite);
+      break;
+
+    case TILE_CMD_TEXT:
+      tile_puts (display, cmd);
+      break;
+
+    case TILE_CMD_POLYLINE:
+      polyline_y (display, cmd->x, cmd->y, cmd->copy, cmd->n, cmd->h,
+                  cmd->color);
+      break;
+  }
+}
+
+static void
+tile_rasterize (struct tile_queue *queue, int tile)
+{
+  display_t local;
+  const struct tile_bin *bin = queue->bins + tile;
+  int i;
+
+  /* Private copy: the clip and the dirty list are per thread */
+  local = *queue->display;
+
+  local.tiles = NULL;
+  local.dirty_count = 0;
+
+  local.clip_x1 = (tile % queue->cols) * DISPLAY_TILE_SIZE;
+  local.clip_y1 = (tile / queue->cols) * DISPLAY_TILE_SIZE;
+  local.clip_x2 = MIN (local.clip_x1 + DISPLAY_TILE_SIZE, local.width);
+  local.clip_y2 = MIN (local.clip_y1 + DISPLAY_TILE_SIZE, local.height);
+
+  for (i = 0; i < bin->count; i++)
+    tile_replay (&local, queue->cmds + bin->cmds[i]);
+}
+
+static void
+tile_work (struct tile_queue *queue)
+{
+  int tile;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&queue->lock);
+
+    if (queue->next_tile < queue->cols * queue->rows)
+      tile = queue->next_tile++;
+    else
+      tile = -1;
+
+    pthread_mutex_unlock (&queue->lock);
+
+    if (tile == -1)
+      break;
+
+    if (queue->bins[tile].count > 0)
+      tile_rasterize (queue, tile);
+  }
+}
+
+static void *
+tile_thread (void *data)
+{
+  struct tile_queue *queue = data;
+  unsigned int seen = 0;
+
+  pthread_mutex_lock (&queue->lock);
+
+  for (;;)
+  {
+    while (!queue->quit && queue->generation == seen)
+      pthread_cond_wait (&queue->start, &queue->lock);
+
+    if (queue->quit)
+      break;
+
+    seen = queue->generation;
+
+    pthread_mutex_unlock (&queue->lock);
+    tile_work (queue);
+    pthread_mutex_lock (&queue->lock);
+
+    if (--queue->busy == 0)
+      pthread_cond_signal (&queue->done);
+  }
+
+  pthread_mutex_unlock (&queue->lock);
+
+  return NULL;
+}
+
+static void
+tile_queue_reset (struct tile_queue *queue)
+{
+  int i;
+
+  for (i = 0; i < queue->count; i++)
+    if (queue->cmds[i].copy != NULL)
+      free (queue->cmds[i].copy);
+
+  for (i = 0; i < queue->cols * queue->rows; i++)
+    queue->bins[i].count = 0;
+
+  queue->count = 0;
+}
+
+static void
+tile_queue_destroy (struct tile_queue *queue)
+{
+  int i;
+
+  pthread_mutex_lock (&queue->lock);
+  queue->quit = 1;
+  pthread_cond_broadcast (&queue->start);
+  pthread_mutex_unlock (&queue->lock);
+
+  for (i = 0; i < queue->thread_count; i++)
+    pthread_join (queue->threads[i], NULL);
+
+  tile_queue_reset (queue);
+
+  for (i = 0; i < queue->cols * queue->rows; i++)
+    if (queue->bins[i].cmds != NULL)
+      free (queue->bins[i].cmds);
+
+  pthread_mutex_destroy (&queue->lock);
+  pthread_cond_destroy (&queue->start);
+  pthread_cond_destroy (&queue->done);
+
+  if (queue->cmds != NULL)
+    free (queue->cmds);
+
+  free (queue->bins);
+  free (queue->threads);
+  free (queue);
+}
+
+static struct tile_queue *
+tile_queue_new (display_t *display, int threads)
+{
+  struct tile_queue *new;
+
+  new = xmalloc (sizeof (struct tile_queue));
+
+  memset (new, 0, sizeof (struct tile_queue));
+
+  new->display = display;
+  new->cols = (display->width  + DISPLAY_TILE_SIZE - 1) / DISPLAY_TILE_SIZE;
+  new->rows = (display->height + DISPLAY_TILE_SIZE - 1) / DISPLAY_TILE_SIZE;
+
+  new->bins = xmalloc (new->cols * new->rows * sizeof (struct tile_bin));
+  memset (new->bins, 0, new->cols * new->rows * sizeof (struct tile_bin));
+
+  /* The thread calling display_sync is the first worker */
+  new->threads = xmalloc (threads * sizeof (pthread_t));
+
+  pthread_mutex_init (&new->lock, NULL);
+  pthread_cond_init (&new->start, NULL);
+  pthread_cond_init (&new->done, NULL);
+
+  for (new->thread_count = 0;
+       new->thread_count < threads - 1;
+       new->thread_count++)
+    if (pthread_create (
+        new->threads + new->thread_count, NULL, tile_thread, new) != 0)
+    {
+      ERROR ("tile_queue_new: cannot create rasterizer thread\n");
+      tile_queue_destroy (new);
+
+      return NULL;
+    }
+
+  return new;
+}
+
+/*
+ * Turn tiled rendering on with the given number of rasterizer threads,
+ * or off if threads is 0. Anything pending is drawn first.
+ */
+int
+display_set_tiled (display_t *display, int threads)
+{
+  display_sync (display);
+
+  if (display->tiles != NULL)
+  {
+    tile_queue_destroy (display->tiles);
+    display->tiles = NULL;
+  }
+
+  if (threads <= 0)
+    return 0;
+
+  if (SDL_MUSTLOCK (display->screen))
+  {
+    ERROR ("display_set_tiled: screen surface needs locking\n");
+    return -1;
+  }
+
+  /* Pick the blending kernels now, not from several threads at once */
+  blend_span_color (display->screen->pixels, 0, ALPHA (1));
+  blend_span_pixels (display->screen->pixels, display->screen->pixels, 0);
+
+  if ((display->tiles = tile_queue_new (display, threads)) == NULL)
+    return -1;
+
+  return 0;
+}
+
+/* Rasterize everything recorded so far */
+void
+display_sync (display_t *display)
+{
+  struct tile_queue *queue = display->tiles;
+
+  if (queue == NULL || queue->count == 0)
+    return;
+
+  pthread_mutex_lock (&queue->lock);
+  queue->next_tile = 0;
+  queue->busy = queue->thread_count;
+  ++queue->generation;
+  pthread_cond_broadcast (&queue->start);
+  pthread_mutex_unlock (&queue->lock);
+
+  tile_work (queue);
+
+  pthread_mutex_lock (&queue->lock);
+  while (queue->busy > 0)
+    pthread_cond_wait (&queue->done, &queue->lock);
+  pthread_mutex_unlock (&queue->lock);
+
+  tile_queue_reset (queue);
+}
+
+/* Append a command and put it in the bins under its bounding box */
+static void
+tile_record (display_t *display, const struct tile_cmd *cmd)
+{
+  struct tile_queue *queue = display->tiles;
+  struct tile_bin *bin;
+  int x = cmd->x, y = cmd->y, w = cmd->w, h = cmd->h;
+  int tx, ty;
+
+  if (!__clip_rect (display, &x, &y, &w, &h))
+  {
+    if (cmd->copy != NULL)
+      free (cmd->copy);
+
+    return;
+  }
+
+  if (queue->count == queue->size)
+  {
+    queue->size = queue->size ? queue->size << 1 : 256;
+    queue->cmds = xrealloc (queue->cmds, queue->size * sizeof (struct tile_cmd));
+  }
+
+  queue->cmds[queue->count] = *cmd;
+
+  for (ty = y / DISPLAY_TILE_SIZE; ty <= (y + h - 1) / DISPLAY_TILE_SIZE; ty++)
+    for (tx = x / DISPLAY_TILE_SIZE; tx <= (x + w - 1) / DISPLAY_TILE_SIZE; tx++)
+    {
+      bin = queue->bins + tx + ty * queue->cols;
+
+      if (bin->count == bin->size)
+      {
+        bin->size = bin->size ? bin->size << 1 : 64;
+        bin->cmds = xrealloc (bin->cmds, bin->size * sizeof (int));
+      }
+
+      bin->cmds[bin->count++] = queue->count;
+    }
+
+  ++queue->count;
+
+  /* Marked as a whole, the per-pixel tracking of the tiles is dropped */
+  __make_dirty_rect (display, x, y, w, h);
+}
+
+void
+tile_record_pset (display_t *display, int x, int y, Uint32 color)
+{
+  struct tile_cmd cmd;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  cmd.type  = TILE_CMD_PSET;
+  cmd.x     = cmd.x1 = x;
+  cmd.y     = cmd.y1 = y;
+  cmd.w     = cmd.h  = 1;
+  cmd.color = color;
+
+  tile_record (display, &cmd);
+}
+
+void
+tile_record_line (display_t *display,
+                  int x1, int y1, int x2, int y2, Uint32 color)
+{
+  struct tile_cmd cmd;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  cmd.type  = TILE_CMD_LINE;
+  cmd.x1    = x1;
+  cmd.y1    = y1;
+  cmd.x2    = x2;
+  cmd.y2    = y2;
+  cmd.x     = MIN (x1, x2);
+  cmd.y     = MIN (y1, y2);
+  cmd.w     = MAX (x1, x2) - cmd.x + 1;
+  cmd.h     = MAX (y1, y2) - cmd.y + 1;
+  cmd.color = color;
+
+  tile_record (display, &cmd);
+}
+
+void
+tile_record_rect (display_t *display, int x, int y, int w, int h, Uint32 color)
+{
+  struct tile_cmd cmd;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  cmd.type  = TILE_CMD_RECT;
+  cmd.x     = x;
+  cmd.y     = y;
+  cmd.w     = w;
+  cmd.h     = h;
+  cmd.color = color;
+
+  tile_record (display, &cmd);
+}
+
+void
+tile_record_blit (display_t *display, int x, int y, int w, int h,
+                  const Uint32 *pixels, int pitch)
+{
+  struct tile_cmd cmd;
+  Uint32 *copy;
+  int j;
+
+  if (w <= 0 || h <= 0)
+    return;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  /* The caller may reuse its buffer before the sync */
+  copy = xmalloc (w * h * sizeof (Uint32));
+
+  for (j = 0; j < h; j++)
+    memcpy (copy + j * w, pixels + j * pitch, w * sizeof (Uint32));
+
+  cmd.type  = TILE_CMD_BLIT;
+  cmd.x     = x;
+  cmd.y     = y;
+  cmd.w     = w;
+  cmd.h     = h;
+  cmd.copy  = copy;
+
+  tile_record (display, &cmd);
+}
+
+void
+tile_record_sprite (display_t *display, int x, int y,
+                    const struct sprite *sprite)
+{
+  struct tile_cmd cmd;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  cmd.type   = TILE_CMD_SPRITE;
+  cmd.x1     = x;
+  cmd.y1     = y;
+  cmd.x      = x - sprite->hot_x;
+  cmd.y      = y - sprite->hot_y;
+  cmd.w      = sprite->width;
+  cmd.h      = sprite->height;
+  cmd.sprite = sprite;
+
+  tile_record (display, &cmd);
+}
+
+void
+tile_record_text (display_t *display, int x, int y,
+                  Uint32 color, Uint32 bgcolor, const char *text)
+{
+  struct tile_cmd cmd;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  cmd.type    = TILE_CMD_TEXT;
+  cmd.x       = cmd.x1 = x;
+  cmd.y       = cmd.y1 = y;
+  cmd.w       = 8 * strlen (text);
+  cmd.h       = display->selected_font->rows;
+  cmd.color   = color;
+  cmd.bgcolor = bgcolor;
+  cmd.font    = display->selected_font;
+  cmd.atlas   = glyph_atlas_get (cmd.font, color, bgcolor);
+  cmd.copy    = xstrdup (text);
+
+  tile_record (display, &cmd);
+}
+
+void
+tile_record_polyline (display_t *display, int x, int y,
+                      const int *ys, int n, int h, Uint32 color)
+{
+  struct tile_cmd cmd;
+
+  if (n <= 0 || h <= 0)
+    return;
+
+  memset (&cmd, 0, sizeof (struct tile_cmd));
+
+  cmd.type  = TILE_CMD_POLYLINE;
+  cmd.x     = x;
+  cmd.y     = y;
+  cmd.w     = n;
+  cmd.h     = h;
+  cmd.n     = n;
+  cmd.color = color;
+  cmd.copy  = xmalloc (n * sizeof (int));
+
+  memcpy (cmd.copy, ys, n * sizeof (int));
+
+  tile_record (display, &cmd);
+}
@@ -37,8 +37,6 @@ draw_new (int width, int height)
   draw->total_size = BITMAP_SIZE (width, height, 24);
   draw->pixels = xmalloc (draw->total_size);
   
-  printf ("Total size: %d\n", draw->total_size);
-  
   memset (draw->pixels, 0, draw->total_size);
   
   return draw;
@@ -31,12 +31,22 @@ xsig_constellation_destroy(xsig_constellation_t *constellation) {
   if (constellation->history != NULL)
     free(constellation->history);
 
+  if (constellation->density != NULL)
+    xsig_density_destroy(constellation->density);
+
+  if (constellation->marker != NULL)
+    sprite_free(constellation->marker);
+
+  if (constellation->background != NULL)
+    sprite_free(constellation->background);
+
   free(constellation);
 }
 
 xsig_constellation_t *
 xsig_constellation_new(const struct xsig_constellation_params *params) {
   xsig_constellation_t *new = NULL;
+  struct xsig_density_params d_params;
 
   assert(params != NULL);
   assert(params->history_size > 0);
@@ -49,6 +59,17 @@ xsig_constellation_new(const struct xsig_constellation_params *params) {
   if ((new->history = malloc(params->history_size * sizeof (SUCOMPLEX))) == NULL)
     goto fail;
 
+  d_params.width = params->width;
+  d_params.height = params->height;
+  d_params.decay = params->decay;
+
+  if ((new->density = xsig_density_new(&d_params)) == NULL)
+    goto fail;
+
+  new->marker = sprite_new_mark(1, 0x7fffffff, 0x7f00ff00);
+
+  xsig_symstats_init(&new->stats, params->stats_alpha);
+
   new->params = *params;
 
   return new;
@@ -60,9 +81,43 @@ fail:
   return NULL;
 }
 
+void
+xsig_constellation_set_mode(
+    xsig_constellation_t *constellation,
+    enum xsig_constellation_mode mode)
+{
+  constellation->mode = mode;
+}
 
+void
+xsig_constellation_get_stats(
+    const xsig_constellation_t *constellation,
+    struct xsig_symstats_report *report)
+{
+  xsig_symstats_report(&constellation->stats, report);
+}
+
+/*
+ * The histogram is fed in both modes, so switching to the density
+ * view shows the whole history at once.
+ */
 void
 xsig_constellation_feed(xsig_constellation_t *constellation, SUCOMPLEX s) {
+  int i, j;
+
+  i = constellation->params.scaling * SU_C_REAL(s)
+      * constellation->params.width + (constellation->params.width >> 1);
+  j = -constellation->params.scaling * SU_C_IMAG(s)
+      * constellation->params.height + (constellation->params.height >> 1);
+
+  xsig_symstats_feed(&constellation->stats, s);
+
+  xsig_density_tick(constellation->density);
+
+  if (i >= 0 && i < constellation->params.width &&
+      j >= 0 && j < constellation->params.height)
+    xsig_density_hit(constellation->density, i, j);
+
   constellation->history[constellation->p++] = s;
 
   if (constellation->size < constellation->params.history_size)
@@ -96,13 +151,15 @@ xsig_draw_polar_grid(const struct xsig_constellation_params *params, display_t *
         OPAQUE(0x1f1f1f));
 }
 
-void
-xsig_constellation_redraw(const xsig_constellation_t *constellation, display_t *disp)
+/*
+ * Grid and axes never change, so they are drawn once and saved. Later
+ * redraws start from a copy of the saved block.
+ */
+SUPRIVATE void
+xsig_constellation_draw_background(
+    xsig_constellation_t *constellation,
+    display_t *disp)
 {
-  int i, j;
-  int old_i, old_j;
-  double Is, Qs;
-  unsigned int k;
   int whalf = constellation->params.width >> 1;
   int hhalf = constellation->params.height >> 1;
 
@@ -143,6 +200,78 @@ xsig_constellation_redraw(const xsig_constellation_t *constellation, display_t *
       constellation->params.y + hhalf,
       OPAQUE(0x3f3f3f));
 
+  constellation->background = sprite_grab(
+      disp,
+      constellation->params.x,
+      constellation->params.y,
+      constellation->params.width,
+      constellation->params.height);
+}
+
+/* Translucent axes, so the histogram under them stays visible */
+SUPRIVATE void
+xsig_constellation_redraw_density(
+    xsig_constellation_t *constellation,
+    display_t *disp)
+{
+  int whalf = constellation->params.width >> 1;
+  int hhalf = constellation->params.height >> 1;
+
+  xsig_density_redraw(
+      constellation->density,
+      disp,
+      constellation->params.x,
+      constellation->params.y);
+
+  box(
+      disp,
+      constellation->params.x,
+      constellation->params.y,
+      constellation->params.x + constellation->params.width - 1,
+      constellation->params.y + constellation->params.height - 1,
+      OPAQUE(0x7f7f7f));
+
+  line(
+      disp,
+      constellation->params.x + whalf,
+      constellation->params.y,
+      constellation->params.x + whalf,
+      constellation->params.y + constellation->params.height - 1,
+      0x3f7f7f7f);
+
+  line(
+      disp,
+      constellation->params.x,
+      constellation->params.y + hhalf,
+      constellation->params.x + constellation->params.width - 1,
+      constellation->params.y + hhalf,
+      0x3f7f7f7f);
+}
+
+void
+xsig_constellation_redraw(xsig_constellation_t *constellation, display_t *disp)
+{
+  int i, j;
+  int old_i, old_j;
+  double Is, Qs;
+  unsigned int k;
+  int whalf = constellation->params.width >> 1;
+  int hhalf = constellation->params.height >> 1;
+
+  if (constellation->mode == XSIG_CONSTELLATION_DENSITY) {
+    xsig_constellation_redraw_density(constellation, disp);
+    return;
+  }
+
+  if (constellation->background == NULL)
+    xsig_constellation_draw_background(constellation, disp);
+  else
+    sprite_put(
+        disp,
+        constellation->params.x,
+        constellation->params.y,
+        constellation->background);
+
   /* Draw points */
   for (k = 0; k < constellation->size; ++k) {
     Is =  constellation->params.scaling * SU_C_REAL(constellation->history[k]);
@@ -153,13 +282,11 @@ xsig_constellation_redraw(const xsig_constellation_t *constellation, display_t *
 
     if (i >= 2 && i < constellation->params.width - 2 &&
         j >= 2 && j < constellation->params.height - 2)
-      mark(
+      sprite_blit(
           disp,
           constellation->params.x + i,
           constellation->params.y + j,
-          1,
-          0x7fffffff,
-          0x7f00ff00);
+          constellation->marker);
 /*
     if (k > 0)
       line(disp, i, j, old_i, old_j, 0x7f00ff00);
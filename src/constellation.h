@@ -3,6 +3,13 @@
 
 #include <sigutils/sigutils.h>
 #include "xsigtool.h"
+#include "density.h"
+#include "symstats.h"
+
+enum xsig_constellation_mode {
+  XSIG_CONSTELLATION_POINTS, /* Last history_size symbols */
+  XSIG_CONSTELLATION_DENSITY /* Decaying histogram of every symbol */
+};
 
 struct xsig_constellation_params {
   double scaling;
@@ -12,21 +19,35 @@ struct xsig_constellation_params {
   unsigned int y;
   unsigned int width;
   unsigned int height;
+  SUFLOAT decay; /* Per-symbol decay of the density histogram */
+  SUFLOAT stats_alpha; /* Per-symbol update rate of the quality metrics */
 };
 
-#define xsig_constellation_params_INITIALIZER { 1, 20, 2, 2, 256, 256 }
+#define xsig_constellation_params_INITIALIZER \
+  { 1, 20, 2, 2, 256, 256, .999, 1e-3 }
 
 typedef struct xsig_constellation {
   struct xsig_constellation_params params;
   SUCOMPLEX *history;
   unsigned int size;
   unsigned int p;
+  enum xsig_constellation_mode mode;
+  xsig_density_t *density;
+  struct sprite *marker;
+  struct sprite *background; /* Grid and axes, saved on first redraw */
+  xsig_symstats_t stats;
 }
 xsig_constellation_t;
 
 void xsig_constellation_destroy(xsig_constellation_t *constellation);
 xsig_constellation_t *xsig_constellation_new(const struct xsig_constellation_params *params);
+void xsig_constellation_set_mode(
+    xsig_constellation_t *constellation,
+    enum xsig_constellation_mode mode);
+void xsig_constellation_get_stats(
+    const xsig_constellation_t *constellation,
+    struct xsig_symstats_report *report);
 void xsig_constellation_feed(xsig_constellation_t *constellation, SUCOMPLEX s);
-void xsig_constellation_redraw(const xsig_constellation_t *constellation, display_t *disp);
+void xsig_constellation_redraw(xsig_constellation_t *constellation, display_t *disp);
 
 #endif /* _CONSTELLATION_H */
@@ -0,0 +1,134 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <xsigtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "density.h"
+
+void
+xsig_density_destroy(xsig_density_t *d) {
+  assert(d != NULL);
+
+  if (d->hits != NULL)
+    free(d->hits);
+
+  if (d->stamp != NULL)
+    free(d->stamp);
+
+  if (d->decay_tab != NULL)
+    free(d->decay_tab);
+
+  free(d);
+}
+
+xsig_density_t *
+xsig_density_new(const struct xsig_density_params *params) {
+  xsig_density_t *new = NULL;
+  unsigned int i;
+  SUFLOAT len;
+
+  assert(params != NULL);
+  assert(params->width > 0);
+  assert(params->height > 0);
+  assert(params->decay > 0 && params->decay < 1);
+
+  if ((new = calloc(1, sizeof(xsig_density_t))) == NULL)
+    goto fail;
+
+  if ((new->hits = calloc(
+      params->width * params->height,
+      sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((new->stamp = calloc(
+      params->width * params->height,
+      sizeof (uint32_t))) == NULL)
+    goto fail;
+
+  /* Ticks until a single hit falls below XSIG_DENSITY_MIN_WEIGHT */
+  len = ceil(log(XSIG_DENSITY_MIN_WEIGHT) / log(params->decay)) + 1;
+  new->decay_len = len > XSIG_DENSITY_MAX_DECAY_LEN
+      ? XSIG_DENSITY_MAX_DECAY_LEN
+      : (uint32_t) len;
+
+  if ((new->decay_tab = malloc(new->decay_len * sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  new->decay_tab[0] = 1;
+  for (i = 1; i < new->decay_len; ++i)
+    new->decay_tab[i] = new->decay_tab[i - 1] * params->decay;
+
+  if ((new->cmap = colormap_builtin(COLORMAP_PHOSPHOR)) == NULL)
+    goto fail;
+
+  new->params = *params;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    xsig_density_destroy(new);
+
+  return NULL;
+}
+
+void
+xsig_density_clear(xsig_density_t *d) {
+  memset(d->hits, 0, d->params.width * d->params.height * sizeof (SUFLOAT));
+}
+
+void
+xsig_density_set_colormap(xsig_density_t *d, const struct colormap *cmap) {
+  d->cmap = cmap;
+}
+
+/*
+ * One pass over the histogram. Decayed values are written back, so
+ * stamps never get old enough to wrap around.
+ */
+void
+xsig_density_redraw(
+    xsig_density_t *d,
+    display_t *disp,
+    unsigned int x,
+    unsigned int y)
+{
+  unsigned int i, j, p;
+  int index;
+  SUFLOAT norm;
+  SUFLOAT v;
+
+  /* A cell hit on every tick converges to 1 / (1 - decay) */
+  norm = (1 - d->params.decay) * (d->cmap->size - 1);
+
+  for (p = 0, j = 0; j < d->params.height; ++j)
+    for (i = 0; i < d->params.width; ++i, ++p) {
+      v = d->hits[p] * xsig_density_weight(d, d->stamp[p]);
+      d->hits[p] = v;
+      d->stamp[p] = d->now;
+
+      index = v * norm < d->cmap->size ? (int) (v * norm) : d->cmap->size;
+
+      pset_abs(disp, x + i, y + j, colormap_lookup(d->cmap, index));
+    }
+}
@@ -0,0 +1,93 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _DENSITY_H
+#define _DENSITY_H
+
+#include <stdint.h>
+#include <sigutils/sigutils.h>
+#include "xsigtool.h"
+
+/*
+ * Cells older than this fraction of a single hit are considered empty.
+ * It also determines the length of the decay table.
+ */
+#define XSIG_DENSITY_MIN_WEIGHT 1e-4
+#define XSIG_DENSITY_MAX_DECAY_LEN (1 << 20)
+
+struct xsig_density_params {
+  unsigned int width;
+  unsigned int height;
+  SUFLOAT decay; /* Per-tick decay factor, 0 < decay < 1 */
+};
+
+/*
+ * Hit-count histogram with exponential decay. Instead of rescanning the
+ * whole buffer every tick, each cell remembers the tick of its last
+ * update and the decay is applied when the cell is touched again (or
+ * when the histogram is rendered).
+ */
+typedef struct xsig_density {
+  struct xsig_density_params params;
+  SUFLOAT *hits;
+  uint32_t *stamp;
+  SUFLOAT *decay_tab; /* decay_tab[n] = decay^n */
+  uint32_t decay_len;
+  uint32_t now;
+  const struct colormap *cmap;
+}
+xsig_density_t;
+
+void xsig_density_destroy(xsig_density_t *d);
+xsig_density_t *xsig_density_new(const struct xsig_density_params *params);
+void xsig_density_clear(xsig_density_t *d);
+void xsig_density_set_colormap(
+    xsig_density_t *d,
+    const struct colormap *cmap);
+void xsig_density_redraw(
+    xsig_density_t *d,
+    display_t *disp,
+    unsigned int x,
+    unsigned int y);
+
+static inline void
+xsig_density_tick(xsig_density_t *d)
+{
+  ++d->now;
+}
+
+static inline SUFLOAT
+xsig_density_weight(const xsig_density_t *d, uint32_t then)
+{
+  uint32_t age = d->now - then;
+
+  return age < d->decay_len ? d->decay_tab[age] : 0;
+}
+
+static inline void
+xsig_density_hit(xsig_density_t *d, unsigned int x, unsigned int y)
+{
+  unsigned int p = x + y * d->params.width;
+
+  d->hits[p] = d->hits[p] * xsig_density_weight(d, d->stamp[p]) + 1;
+  d->stamp[p] = d->now;
+}
+
+#endif /* _DENSITY_H */
@@ -20,6 +20,9 @@
 #include <sigutils/sigutils.h>
 
 #include "constellation.h"
+#include "noisefloor.h"
+#include "persistence.h"
+#include "render.h"
 #include "waterfall.h"
 #include "source.h"
 #include "spectrum.h"
@@ -27,25 +30,88 @@
 #define SCREEN_WIDTH  640
 #define SCREEN_HEIGHT 480
 
+#define XSIGTOOL_STATS_INTERVAL 10000 /* Symbols between headless reports */
+#define XSIGTOOL_TICKER_BATCH   64    /* Symbols appended to the ticker at once */
+
 struct xsig_interface {
   xsig_waterfall_t *wf;
   xsig_spectrum_t *s;
+  xsig_persistence_t *p;
+  xsig_noise_floor_t *nf;
   su_channel_detector_t *cd;
 };
 
+SUPRIVATE SUBOOL xsigtool_show_persistence = SU_FALSE;
+SUPRIVATE SUBOOL xsigtool_show_density = SU_FALSE;
+SUPRIVATE enum colormap_type xsigtool_colormap = COLORMAP_GRAYSCALE;
+SUPRIVATE int xsigtool_scroll_pages = 0; /* Requested, applied on redraw */
+SUPRIVATE SUBOOL xsigtool_go_live = SU_FALSE;
+
+SUPRIVATE int
+xsigtool_on_persistence_key(int code, display_t *disp, event_t *event)
+{
+  if (event->state)
+    xsigtool_show_persistence = !xsigtool_show_persistence;
+
+  return HOOK_RESUME_CHAIN;
+}
+
+SUPRIVATE int
+xsigtool_on_density_key(int code, display_t *disp, event_t *event)
+{
+  if (event->state)
+    xsigtool_show_density = !xsigtool_show_density;
+
+  return HOOK_RESUME_CHAIN;
+}
+
+SUPRIVATE int
+xsigtool_on_colormap_key(int code, display_t *disp, event_t *event)
+{
+  if (event->state)
+    xsigtool_colormap = (xsigtool_colormap + 1) % COLORMAP_TYPE_COUNT;
+
+  return HOOK_RESUME_CHAIN;
+}
+
+SUPRIVATE int
+xsigtool_on_scroll_key(int code, display_t *disp, event_t *event)
+{
+  if (event->state) {
+    if (code == 'b')
+      ++xsigtool_scroll_pages;
+    else if (code == 'f')
+      --xsigtool_scroll_pages;
+    else
+      xsigtool_go_live = SU_TRUE;
+  }
+
+  return HOOK_RESUME_CHAIN;
+}
+
 SUPRIVATE void
 xsigtool_onacquire(struct xsig_source *source, void *private)
 {
   unsigned int i;
   struct xsig_interface *iface = (struct xsig_interface *) private;
 
+  xsig_noise_floor_feed(iface->nf, source->fft);
   xsig_waterfall_feed(iface->wf, source->fft);
   xsig_spectrum_feed(iface->s, source->fft);
+  xsig_persistence_feed(iface->p, source->fft);
 
   for (i = 0; i < source->params.window_size; ++i)
     su_channel_detector_feed(iface->cd, source->window[i]);
 }
 
+SUPRIVATE SUBOOL
+xsigtool_is_raw_iq(const char *path)
+{
+  size_t len = strlen(path);
+
+  return len >= 4 && strcmp(path + len - 4, ".raw") == 0;
+}
+
 SUBOOL
 su_modem_set_xsig_source(
     su_modem_t *modem,
@@ -63,7 +129,7 @@ su_modem_set_xsig_source(
   params.onacquire = xsigtool_onacquire;
   params.raw_iq = SU_FALSE;
 
-  if (strcmp(path + strlen(path) - 4, ".raw") == 0) {
+  if (xsigtool_is_raw_iq(path)) {
     params.raw_iq = SU_TRUE;
     params.samp_rate = 250000;
   }
@@ -211,6 +277,69 @@ xsigtool_redraw_channels(display_t *disp, const struct xsig_interface *iface)
     }
 }
 
+SUPRIVATE void
+xsigtool_print_stats(const xsig_constellation_t *cons, SUFLOAT fc)
+{
+  struct xsig_symstats_report report;
+  unsigned int k;
+
+  xsig_constellation_get_stats(cons, &report);
+
+  printf(
+      "%llu symbols, carrier %.3lf Hz: EVM %.2lf%%, MER %.2lf dB, "
+      "phase %.2lf deg rms (%+.2lf mean)",
+      (unsigned long long) report.count,
+      fc,
+      report.evm,
+      report.mer,
+      report.phase_rms,
+      report.phase_mean);
+
+  for (k = 0; k < XSIG_SYMSTATS_QUADRANTS; ++k)
+    printf(
+        ", %c: %+.3lf%+.3lfi (var %.3lg)",
+        k + 'A',
+        SU_C_REAL(report.centroid[k]),
+        SU_C_IMAG(report.centroid[k]),
+        report.variance[k]);
+
+  putchar('\n');
+}
+
+SUPRIVATE void
+xsigtool_redraw_stats(display_t *disp, const xsig_constellation_t *cons)
+{
+  struct xsig_symstats_report report;
+
+  xsig_constellation_get_stats(cons, &report);
+
+  display_printf(
+      disp,
+      2 + 24 * 8,
+      disp->height - 9,
+      OPAQUE(0xbfbfbf),
+      OPAQUE(0),
+      "EVM: %5.1lf%%  MER: %5.1lf dB  Phase: %5.2lf deg",
+      report.evm,
+      report.mer,
+      report.phase_rms);
+}
+
+SUPRIVATE void
+xsigtool_usage(const char *argv0)
+{
+  fprintf(
+      stderr,
+      "Usage:\n"
+      "\t%s [-w spill_file] [-t threads] file.wav\n"
+      "\t%s -n file.wav\n"
+      "\t%s -r output.bmp [-j threads] file.wav\n",
+      argv0,
+      argv0,
+      argv0);
+  exit(EXIT_FAILURE);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -218,11 +347,20 @@ main(int argc, char *argv[])
   struct xsig_constellation_params cons_params = xsig_constellation_params_INITIALIZER;
   struct xsig_waterfall_params wf_params;
   struct xsig_spectrum_params s_params;
+  struct xsig_persistence_params p_params;
+  struct xsig_noise_floor_params nf_params =
+      xsig_noise_floor_params_INITIALIZER;
+  struct xsig_spill_params spill_params;
+  struct xsig_render_params render_params = xsig_render_params_INITIALIZER;
   struct sigutils_channel_detector_params cd_params =
       sigutils_channel_detector_params_INITIALIZER;
   xsig_constellation_t *cons = NULL;
-  textarea_t *area;
-  display_t *disp;
+  xsig_spill_t *spill = NULL;
+  const char *spill_path = NULL;
+  textarea_t *area = NULL;
+  display_t *disp = NULL;
+  SUBOOL headless = SU_FALSE;
+  int tiled_threads = 0;
   SUCOMPLEX sample = 0;
   unsigned int count = 0;
   struct xsig_source *instance;
@@ -232,18 +370,62 @@ main(int argc, char *argv[])
   SUBOOL *afc;
   uint32_t colors[4] = {0xffffff7f, 0xff7f7fff, 0xff7fff7f, 0xffff7f7f};
   char sym;
-
-  if (argc != 2) {
-    fprintf(stderr, "Usage:\n\t%s file.wav\n", argv[0]);
-    exit(EXIT_FAILURE);
+  char ticker_syms[XSIGTOOL_TICKER_BATCH];
+  uint32_t ticker_colors[XSIGTOOL_TICKER_BATCH];
+  unsigned int ticker_count = 0;
+  int c;
+
+  while ((c = getopt(argc, argv, "nw:r:j:t:")) != -1) {
+    switch (c) {
+      case 'n':
+        headless = SU_TRUE;
+        break;
+
+      case 'w':
+        spill_path = optarg;
+        break;
+
+      case 'r':
+        render_params.output = optarg;
+        break;
+
+      case 'j':
+        if (atoi(optarg) < 0)
+          xsigtool_usage(argv[0]);
+        render_params.threads = atoi(optarg);
+        break;
+
+      case 't':
+        tiled_threads = atoi(optarg);
+        break;
+
+      default:
+        xsigtool_usage(argv[0]);
+    }
   }
 
+  if (argc - optind != 1)
+    xsigtool_usage(argv[0]);
+
   if (!su_lib_init()) {
     fprintf(stderr, "%s: failed to initialize library\n", argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  if ((modem = xsig_modem_init(argv[1], &instance)) == NULL)
+  /* Headless mode: render the whole capture to a BMP and leave */
+  if (render_params.output != NULL) {
+    render_params.file = argv[optind];
+    render_params.raw_iq = xsigtool_is_raw_iq(argv[optind]);
+
+    if (!xsig_render(&render_params)) {
+      fprintf(stderr, "%s: failed to render spectrogram\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    return 0;
+  }
+
+  if ((modem = xsig_modem_init(argv[optind], &instance)) == NULL)
     exit(EXIT_FAILURE);
 
   if ((fc = su_modem_get_state_property_ref(
@@ -270,12 +452,18 @@ main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
 
-
-  if ((disp = display_new(SCREEN_WIDTH, SCREEN_HEIGHT)) == NULL) {
+  /* Headless mode only prints the signal quality metrics */
+  if (!headless
+      && (disp = display_new(SCREEN_WIDTH, SCREEN_HEIGHT)) == NULL) {
     fprintf(stderr, "%s: failed to initialize display\n", argv[0]);
     exit(EXIT_FAILURE);
   }
 
+  if (disp != NULL
+      && tiled_threads > 0
+      && display_set_tiled(disp, tiled_threads) == -1)
+    fprintf(stderr, "%s: tiled rendering disabled\n", argv[0]);
+
   cons_params.scaling = .25;
   cons_params.history_size = 20;
   cons_params.width = 128;
@@ -286,17 +474,45 @@ main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
 
+  nf_params.fft_size = 512;
+
+  if ((interface.nf = xsig_noise_floor_new(&nf_params)) == NULL) {
+    fprintf(stderr, "%s: cannot create noise floor estimator\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
   wf_params.fft_size = 512;
   wf_params.width = 512;
   wf_params.height = 128;
   wf_params.x = 3;
   wf_params.y = 133;
+  wf_params.depth = 8;
+  wf_params.range = 60; /* dB */
+  wf_params.samp_rate = instance->samp_rate;
+  wf_params.row_rate = 25; /* The 128 rows span about 5 seconds */
+  wf_params.reduce = XSIG_WATERFALL_REDUCE_MAX;
 
   if ((interface.wf = xsig_waterfall_new(&wf_params)) == NULL) {
     fprintf(stderr, "%s: cannot create waterfall\n", argv[0]);
     exit(EXIT_FAILURE);
   }
 
+  xsig_waterfall_set_noise_floor(interface.wf, interface.nf);
+
+  /* Rows scrolled out of the waterfall are kept on disk, if requested */
+  if (spill_path != NULL) {
+    spill_params.path = spill_path;
+    spill_params.width = wf_params.width;
+    spill_params.depth = wf_params.depth;
+
+    if ((spill = xsig_spill_new(&spill_params)) == NULL) {
+      fprintf(stderr, "%s: cannot create spill file\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    xsig_waterfall_set_spill(interface.wf, spill);
+  }
+
   s_params.fft_size = 512;
   s_params.width = 512;
   s_params.height = 128;
@@ -318,6 +534,32 @@ main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
 
+  xsig_spectrum_set_noise_floor(interface.s, interface.nf);
+
+  /* Persistence view shares the spectrum panel, toggled with `p' */
+  p_params.fft_size = s_params.fft_size;
+  p_params.width = s_params.width;
+  p_params.height = s_params.height;
+  p_params.x = s_params.x;
+  p_params.y = s_params.y;
+  p_params.scale = s_params.scale;
+  p_params.ref = s_params.ref;
+  p_params.decay = .99;
+
+  if ((interface.p = xsig_persistence_new(&p_params)) == NULL) {
+    fprintf(stderr, "%s: cannot create persistence view\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (!headless) {
+    display_register_key_handler(disp, 'p', xsigtool_on_persistence_key);
+    display_register_key_handler(disp, 'c', xsigtool_on_colormap_key);
+    display_register_key_handler(disp, 'd', xsigtool_on_density_key);
+    display_register_key_handler(disp, 'b', xsigtool_on_scroll_key);
+    display_register_key_handler(disp, 'f', xsigtool_on_scroll_key);
+    display_register_key_handler(disp, 'l', xsigtool_on_scroll_key);
+  }
+
   cd_params.samp_rate = instance->samp_rate;
   cd_params.alpha = 1e-3;
 
@@ -326,23 +568,61 @@ main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
 
-  if ((area = display_textarea_new (disp, 133, 3, 48, 16, NULL, 850, 8))
-      == NULL) {
-    fprintf(stderr, "%s: failed to create textarea\n", argv[0]);
-    exit(EXIT_FAILURE);
-  }
+  if (!headless) {
+    if ((area = display_textarea_new (disp, 133, 3, 48, 16, NULL, 850, 8))
+        == NULL) {
+      fprintf(stderr, "%s: failed to create textarea\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
 
-  area->autorefresh = 0;
+    area->autorefresh = 0;
+  }
 
   instance->params.private = &interface;
 
   while (!isnan(SU_C_ABS(sample = su_modem_read_sample(modem)))) {
     sym = ((SU_C_REAL(sample) > 0) << 1) | (SU_C_IMAG(sample) > 0);
     xsig_constellation_feed(cons, sample);
-    if (++count % cons_params.history_size == 0) {
+    ++count;
+
+    if (headless) {
+      if (count % XSIGTOOL_STATS_INTERVAL == 0)
+        xsigtool_print_stats(cons, *fc);
+      continue;
+    }
+
+    ticker_syms[ticker_count] = sym + 'A';
+    ticker_colors[ticker_count] = colors[sym];
+    if (++ticker_count == XSIGTOOL_TICKER_BATCH) {
+      textarea_put_symbols(area, ticker_syms, ticker_colors, ticker_count);
+      ticker_count = 0;
+    }
+
+    if (count % cons_params.history_size == 0) {
+      xsig_waterfall_set_colormap(
+          interface.wf,
+          colormap_builtin(xsigtool_colormap));
+      if (xsigtool_go_live) {
+        xsig_waterfall_live(interface.wf);
+        xsigtool_go_live = SU_FALSE;
+        xsigtool_scroll_pages = 0;
+      } else if (xsigtool_scroll_pages != 0) {
+        xsig_waterfall_scroll(
+            interface.wf,
+            (int64_t) xsigtool_scroll_pages * wf_params.height);
+        xsigtool_scroll_pages = 0;
+      }
+      xsig_constellation_set_mode(
+          cons,
+          xsigtool_show_density
+          ? XSIG_CONSTELLATION_DENSITY
+          : XSIG_CONSTELLATION_POINTS);
       xsig_constellation_redraw(cons, disp);
       xsig_waterfall_redraw(interface.wf, disp);
-      xsig_spectrum_redraw(interface.s, disp);
+      if (xsigtool_show_persistence)
+        xsig_persistence_redraw(interface.p, disp);
+      else
+        xsig_spectrum_redraw(interface.s, disp);
       xsigtool_redraw_channels(disp, &interface);
       display_printf(
           disp,
@@ -351,16 +631,23 @@ main(int argc, char *argv[])
           OPAQUE(0xbfbfbf),
           OPAQUE(0),
           "Carrier: %8.3lf Hz", *fc);
-      textarea_set_fore_color(area, colors[sym]);
-      cprintf(area, "%c", sym + 'A');
+      xsigtool_redraw_stats(disp, cons);
+      textarea_put_symbols(area, ticker_syms, ticker_colors, ticker_count);
+      ticker_count = 0;
       display_refresh(disp);
     }
     usleep(1000);
   }
 
-  display_end(disp);
+  if (headless)
+    xsigtool_print_stats(cons, *fc);
+  else
+    display_end(disp);
 
   su_modem_destroy(modem);
 
+  if (spill != NULL)
+    xsig_spill_destroy(spill);
+
   return 0;
 }
@@ -0,0 +1,107 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <xsigtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "noisefloor.h"
+
+void
+xsig_noise_floor_destroy(xsig_noise_floor_t *nf) {
+  assert(nf != NULL);
+
+  if (nf->power != NULL)
+    free(nf->power);
+
+  if (nf->floor != NULL)
+    free(nf->floor);
+
+  free(nf);
+}
+
+xsig_noise_floor_t *
+xsig_noise_floor_new(const struct xsig_noise_floor_params *params) {
+  xsig_noise_floor_t *new = NULL;
+
+  assert(params != NULL);
+  assert(params->fft_size > 0);
+  assert(params->quantile > 0 && params->quantile < 1);
+  assert(params->step > 0);
+
+  if ((new = calloc(1, sizeof (xsig_noise_floor_t))) == NULL)
+    goto fail;
+
+  if ((new->power = calloc(params->fft_size, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((new->floor = calloc(params->fft_size, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  new->params = *params;
+  new->up   = exp(params->step * params->quantile);
+  new->down = exp(-params->step * (1 - params->quantile));
+
+  return new;
+
+fail:
+  if (new != NULL)
+    xsig_noise_floor_destroy(new);
+
+  return NULL;
+}
+
+/*
+ * O(fft_size) per frame. The power and update passes are branch-free
+ * over flat arrays (the comparison turns into a select), so the
+ * compiler vectorizes them.
+ */
+void
+xsig_noise_floor_feed(xsig_noise_floor_t *nf, const SUCOMPLEX *x) {
+  unsigned int i;
+  unsigned int size = nf->params.fft_size;
+  SUFLOAT *power = nf->power;
+  SUFLOAT *est = nf->floor;
+  SUFLOAT up = nf->up;
+  SUFLOAT down = nf->down;
+  SUFLOAT sum = 0;
+  SUFLOAT q;
+
+  for (i = 0; i < size; ++i)
+    power[i] = SU_C_REAL(x[i]) * SU_C_REAL(x[i])
+        + SU_C_IMAG(x[i]) * SU_C_IMAG(x[i]);
+
+  if (!nf->primed) {
+    for (i = 0; i < size; ++i)
+      est[i] = MAX(power[i], XSIG_NOISE_FLOOR_MIN);
+    nf->primed = SU_TRUE;
+  }
+
+  for (i = 0; i < size; ++i) {
+    q = est[i] * (power[i] > est[i] ? up : down);
+    est[i] = MAX(q, XSIG_NOISE_FLOOR_MIN);
+  }
+
+  for (i = 0; i < size; ++i)
+    sum += est[i];
+
+  nf->level = sum / size;
+}
@@ -0,0 +1,94 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _NOISEFLOOR_H
+#define _NOISEFLOOR_H
+
+#include <sigutils/sigutils.h>
+
+#define XSIG_NOISE_FLOOR_MIN 1e-20 /* Keeps the estimate away from zero */
+
+struct xsig_noise_floor_params {
+  unsigned int fft_size;
+  SUFLOAT quantile; /* Tracked quantile of each bin, .5 for the median */
+  SUFLOAT step;     /* Adaptation step, in nepers per FFT frame */
+};
+
+#define xsig_noise_floor_params_INITIALIZER { 512, .5, 5e-2 }
+
+/*
+ * Per-bin noise floor. Each bin tracks a quantile of its power over
+ * time with a multiplicative "frugal" estimator: one value per bin,
+ * nudged up by exp(step * q) when the new sample is above it and
+ * down by exp(-step * (1 - q)) otherwise. It settles where
+ * P(x > estimate) = 1 - q, so intermittent signals barely move it.
+ */
+typedef struct xsig_noise_floor {
+  struct xsig_noise_floor_params params;
+  SUFLOAT *power; /* |X|^2 of the last frame */
+  SUFLOAT *floor; /* Per-bin quantile estimate of |X|^2 */
+  SUFLOAT up;
+  SUFLOAT down;
+  SUFLOAT level;  /* Mean of floor[] over all bins */
+  SUBOOL primed;
+}
+xsig_noise_floor_t;
+
+void xsig_noise_floor_destroy(xsig_noise_floor_t *nf);
+xsig_noise_floor_t *xsig_noise_floor_new(
+    const struct xsig_noise_floor_params *params);
+void xsig_noise_floor_feed(xsig_noise_floor_t *nf, const SUCOMPLEX *fft);
+
+/* Noise floor of a bin, in |X|^2 units */
+static inline SUFLOAT
+xsig_noise_floor_get(const xsig_noise_floor_t *nf, unsigned int bin)
+{
+  return nf->floor[bin];
+}
+
+/* Noise floor of a bin, in dBFS as displayed by xsig_spectrum */
+static inline SUFLOAT
+xsig_noise_floor_dbfs(const xsig_noise_floor_t *nf, unsigned int bin)
+{
+  SUFLOAT K = 1. / nf->params.fft_size;
+
+  return .5 * SU_DB_RAW(nf->floor[bin] * K * K);
+}
+
+/* Average noise floor across the band, in |X|^2 units */
+static inline SUFLOAT
+xsig_noise_floor_level(const xsig_noise_floor_t *nf)
+{
+  return nf->level;
+}
+
+/* Detection threshold: is x at least `snr' (linear, power) above floor? */
+static inline SUBOOL
+xsig_noise_floor_exceeds(
+    const xsig_noise_floor_t *nf,
+    unsigned int bin,
+    SUCOMPLEX x,
+    SUFLOAT snr)
+{
+  return SU_C_REAL(x) * SU_C_REAL(x) + SU_C_IMAG(x) * SU_C_IMAG(x)
+      > snr * nf->floor[bin];
+}
+
+#endif /* _NOISEFLOOR_H */
@@ -0,0 +1,140 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <xsigtool.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "persistence.h"
+
+void
+xsig_persistence_destroy(xsig_persistence_t *p) {
+  assert(p != NULL);
+
+  if (p->density != NULL)
+    xsig_density_destroy(p->density);
+
+  free(p);
+}
+
+xsig_persistence_t *
+xsig_persistence_new(const struct xsig_persistence_params *params) {
+  xsig_persistence_t *new = NULL;
+  struct xsig_density_params d_params;
+
+  assert(params != NULL);
+  assert(params->fft_size > 0);
+  assert(params->width > 0);
+  assert(params->height > 0);
+
+  if ((new = calloc(1, sizeof (xsig_persistence_t))) == NULL)
+    goto fail;
+
+  d_params.width = params->width;
+  d_params.height = params->height;
+  d_params.decay = params->decay;
+
+  if ((new->density = xsig_density_new(&d_params)) == NULL)
+    goto fail;
+
+  new->params = *params;
+
+  return new;
+
+fail:
+  if (new != NULL)
+    xsig_persistence_destroy(new);
+
+  return NULL;
+}
+
+/* Vertical position of a magnitude, -1 above the graph, height below it */
+SUPRIVATE int
+xsig_persistence_level(const xsig_persistence_t *p, SUFLOAT mag)
+{
+  SUFLOAT dBFS;
+  SUFLOAT level;
+
+  dBFS = SU_DB_RAW(mag / p->params.fft_size);
+  level = p->params.height * p->params.scale * (1. - dBFS + p->params.ref);
+
+  if (level < 0)
+    return -1;
+  else if (level >= p->params.height)
+    return p->params.height;
+
+  return (int) level;
+}
+
+/*
+ * Called once per FFT frame. Each column receives the vertical span
+ * joining it with the previous one, so the trace stays connected.
+ */
+void
+xsig_persistence_feed(xsig_persistence_t *p, const SUCOMPLEX *x) {
+  unsigned int i;
+  unsigned int bin;
+  unsigned int halfsize = p->params.fft_size / 2;
+  int height = p->params.height;
+  int j, old_j = 0;
+  int y_1, y_2;
+
+  xsig_density_tick(p->density);
+
+  for (i = 0; i < p->params.width; ++i) {
+    bin = (i * p->params.fft_size / p->params.width + halfsize)
+        % p->params.fft_size;
+
+    j = xsig_persistence_level(p, SU_C_ABS(x[bin]));
+
+    if (i == 0)
+      old_j = j;
+
+    if ((j >= 0 && j < height) || (old_j >= 0 && old_j < height)) {
+      y_1 = MIN(j, old_j);
+      y_2 = MAX(j, old_j);
+
+      if (y_1 < 0)
+        y_1 = 0;
+
+      if (y_2 >= height)
+        y_2 = height - 1;
+
+      for (; y_1 <= y_2; ++y_1)
+        xsig_density_hit(p->density, i, y_1);
+    }
+
+    old_j = j;
+  }
+}
+
+void
+xsig_persistence_redraw(xsig_persistence_t *p, display_t *disp)
+{
+  box(
+      disp,
+      p->params.x,
+      p->params.y,
+      p->params.x + p->params.width  + 1,
+      p->params.y + p->params.height + 1,
+      OPAQUE(0x7f7f7f));
+
+  xsig_density_redraw(p->density, disp, p->params.x + 1, p->params.y + 1);
+}
@@ -0,0 +1,56 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _PERSISTENCE_H
+#define _PERSISTENCE_H
+
+#include <sigutils/sigutils.h>
+#include "density.h"
+
+/*
+ * Persistence ("phosphor") spectrum. Same geometry and level
+ * semantics as xsig_spectrum, but every FFT frame is rasterized
+ * into a decaying density histogram instead of being averaged.
+ */
+struct xsig_persistence_params {
+  unsigned int fft_size;
+  unsigned int width;
+  unsigned int height;
+  unsigned int x;
+  unsigned int y;
+  SUFLOAT scale;
+  SUFLOAT ref;
+  SUFLOAT decay; /* Per-FFT-frame decay of the histogram */
+};
+
+struct xsig_persistence {
+  struct xsig_persistence_params params;
+  xsig_density_t *density;
+};
+
+typedef struct xsig_persistence xsig_persistence_t;
+
+void xsig_persistence_destroy(xsig_persistence_t *p);
+xsig_persistence_t *xsig_persistence_new(
+    const struct xsig_persistence_params *params);
+void xsig_persistence_feed(xsig_persistence_t *p, const SUCOMPLEX *fft);
+void xsig_persistence_redraw(xsig_persistence_t *p, display_t *disp);
+
+#endif /* _PERSISTENCE_H */
@@ -0,0 +1,427 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <xsigtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <sigutils/taps.h>
+
+#include "render.h"
+
+/*
+ * The capture is split in more segments than threads, and idle
+ * workers take the next segment from the job. Every segment becomes a
+ * tile that its worker copies into the final image, which is possible
+ * without locking because tiles never overlap.
+ */
+struct xsig_render_job {
+  const struct xsig_render_params *params;
+  const struct colormap *cmap;
+  struct draw *image;
+  uint64_t frames_per_row;
+  uint64_t rows;
+  unsigned int segments;
+  unsigned int next;    /* Next segment to be taken */
+  SUBOOL failed;
+  pthread_mutex_t lock; /* Protects next, failed and FFTW planning */
+};
+
+struct xsig_render_worker {
+  struct xsig_render_job *job;
+  pthread_t thread;
+  SNDFILE *sf;
+  SF_INFO info;
+  SUFLOAT *samples; /* One frame, interleaved as in the file */
+  XSIG_FFTW(_complex) *window;
+  XSIG_FFTW(_complex) *fft;
+  XSIG_FFTW(_plan) plan;
+  SUFLOAT *acc;     /* Reduced magnitudes of the current row */
+};
+
+SUPRIVATE SNDFILE *
+xsig_render_open(const struct xsig_render_params *params, SF_INFO *info)
+{
+  SNDFILE *sf;
+
+  memset(info, 0, sizeof (SF_INFO));
+
+  if (params->raw_iq) {
+    info->format = SF_FORMAT_RAW | SF_FORMAT_FLOAT | SF_ENDIAN_LITTLE;
+    info->channels = 2;
+    info->samplerate = params->samp_rate;
+  }
+
+  if ((sf = sf_open(params->file, SFM_READ, info)) == NULL)
+    SU_ERROR(
+        "failed to open `%s': error %s\n",
+        params->file,
+        sf_strerror(NULL));
+
+  return sf;
+}
+
+SUPRIVATE void
+xsig_render_worker_finalize(struct xsig_render_worker *worker)
+{
+  if (worker->sf != NULL)
+    sf_close(worker->sf);
+
+  if (worker->plan != NULL)
+    XSIG_FFTW(_destroy_plan)(worker->plan);
+
+  if (worker->samples != NULL)
+    free(worker->samples);
+
+  if (worker->window != NULL)
+    fftw_free(worker->window);
+
+  if (worker->fft != NULL)
+    fftw_free(worker->fft);
+
+  if (worker->acc != NULL)
+    free(worker->acc);
+}
+
+SUPRIVATE SUBOOL
+xsig_render_worker_init(struct xsig_render_worker *worker)
+{
+  unsigned int size = worker->job->params->fft_size;
+
+  if ((worker->sf = xsig_render_open(worker->job->params, &worker->info))
+      == NULL)
+    return SU_FALSE;
+
+  if ((worker->samples = malloc(
+      size * worker->info.channels * sizeof (SUFLOAT))) == NULL)
+    return SU_FALSE;
+
+  if ((worker->window = fftw_malloc(size * sizeof (XSIG_FFTW(_complex))))
+      == NULL)
+    return SU_FALSE;
+
+  if ((worker->fft = fftw_malloc(size * sizeof (XSIG_FFTW(_complex))))
+      == NULL)
+    return SU_FALSE;
+
+  if ((worker->acc = malloc(size * sizeof (SUFLOAT))) == NULL)
+    return SU_FALSE;
+
+  /* Only plan execution is thread safe in FFTW */
+  pthread_mutex_lock(&worker->job->lock);
+  worker->plan = XSIG_FFTW(_plan_dft_1d)(
+      size,
+      worker->window,
+      worker->fft,
+      FFTW_FORWARD,
+      FFTW_ESTIMATE);
+  pthread_mutex_unlock(&worker->job->lock);
+
+  if (worker->plan == NULL) {
+    SU_ERROR("failed to create FFT plan\n");
+    return SU_FALSE;
+  }
+
+  return SU_TRUE;
+}
+
+/* Read, window and transform the next frame */
+SUPRIVATE SUBOOL
+xsig_render_worker_fft(struct xsig_render_worker *worker)
+{
+  unsigned int i;
+  unsigned int size = worker->job->params->fft_size;
+  unsigned int channels = worker->info.channels;
+
+  if (XSIG_SNDFILE_READF(worker->sf, worker->samples, size) != size) {
+    SU_ERROR("read failed\n");
+    return SU_FALSE;
+  }
+
+  /* Two channels are I and Q. Anything else is read as a real signal */
+  if (channels == 2)
+    for (i = 0; i < size; ++i)
+      worker->window[i] =
+          worker->samples[2 * i] + I * worker->samples[2 * i + 1];
+  else
+    for (i = 0; i < size; ++i)
+      worker->window[i] = worker->samples[i * channels];
+
+  su_taps_apply_hann_complex(worker->window, size);
+
+  XSIG_FFTW(_execute)(worker->plan);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE SUBOOL
+xsig_render_worker_row(struct xsig_render_worker *worker)
+{
+  unsigned int i;
+  unsigned int n;
+  unsigned int size = worker->job->params->fft_size;
+  SUFLOAT *restrict acc = worker->acc;
+  SUFLOAT mag;
+
+  for (n = 0; n < worker->job->frames_per_row; ++n) {
+    if (!xsig_render_worker_fft(worker))
+      return SU_FALSE;
+
+    if (n == 0)
+      for (i = 0; i < size; ++i)
+        acc[i] = SU_C_ABS(worker->fft[i]);
+    else if (worker->job->params->reduce == XSIG_WATERFALL_REDUCE_MAX)
+      for (i = 0; i < size; ++i) {
+        mag = SU_C_ABS(worker->fft[i]);
+        acc[i] = acc[i] > mag ? acc[i] : mag;
+      }
+    else
+      for (i = 0; i < size; ++i)
+        acc[i] += SU_C_ABS(worker->fft[i]);
+  }
+
+  if (worker->job->params->reduce == XSIG_WATERFALL_REDUCE_MEAN)
+    for (i = 0; i < size; ++i)
+      acc[i] /= worker->job->frames_per_row;
+
+  return SU_TRUE;
+}
+
+/* Same dBFS scale as the spectrum, with negative frequencies on the left */
+SUPRIVATE void
+xsig_render_worker_colorize(
+    const struct xsig_render_worker *worker,
+    struct draw *tile,
+    unsigned int y)
+{
+  unsigned int i;
+  unsigned int size = worker->job->params->fft_size;
+  unsigned int halfsize = size / 2;
+  SUFLOAT K = 1. / size;
+  SUFLOAT bottom = worker->job->params->ref - worker->job->params->range;
+  SUFLOAT inv_range = 1. / worker->job->params->range;
+  SUFLOAT dBFS;
+  Uint32 color;
+  BYTE *p;
+
+  for (i = 0; i < size; ++i) {
+    dBFS = SU_DB_RAW(
+        MAX(worker->acc[(i + halfsize) % size] * K, XSIG_WATERFALL_MIN_MAG));
+    color = worker->job->cmap->lut[
+        colormap_quantize(worker->job->cmap, (dBFS - bottom) * inv_range)];
+
+    p = tile->pixels + PIX_OFFSET(i, y, tile->width, tile->height, 24);
+    p[0] = color;
+    p[1] = color >> 8;
+    p[2] = color >> 16;
+  }
+}
+
+/*
+ * BMP rows are stored bottom-up, so the tile of image rows
+ * [first, last) is one contiguous block ending where row first - 1
+ * begins.
+ */
+SUPRIVATE void
+xsig_render_stitch(
+    struct draw *image,
+    const struct draw *tile,
+    uint64_t last)
+{
+  memcpy(
+      image->pixels
+      + (image->height - last) * BITMAP_ROW_BYTES(image->width * 24),
+      tile->pixels,
+      tile->total_size);
+}
+
+SUPRIVATE SUBOOL
+xsig_render_worker_segment(
+    struct xsig_render_worker *worker,
+    unsigned int segment)
+{
+  struct xsig_render_job *job = worker->job;
+  struct draw *tile;
+  uint64_t first = segment * job->rows / job->segments;
+  uint64_t last = (segment + 1) * job->rows / job->segments;
+  uint64_t row;
+
+  if (first == last)
+    return SU_TRUE;
+
+  if (sf_seek(
+      worker->sf,
+      first * job->frames_per_row * job->params->fft_size,
+      SEEK_SET) == -1) {
+    SU_ERROR("seek failed: %s\n", sf_strerror(worker->sf));
+    return SU_FALSE;
+  }
+
+  tile = draw_new(job->params->fft_size, last - first);
+
+  for (row = first; row < last; ++row) {
+    if (!xsig_render_worker_row(worker)) {
+      draw_free(tile);
+      return SU_FALSE;
+    }
+
+    xsig_render_worker_colorize(worker, tile, row - first);
+  }
+
+  xsig_render_stitch(job->image, tile, last);
+
+  draw_free(tile);
+
+  return SU_TRUE;
+}
+
+SUPRIVATE void *
+xsig_render_worker_thread(void *private)
+{
+  struct xsig_render_worker *worker = (struct xsig_render_worker *) private;
+  struct xsig_render_job *job = worker->job;
+  unsigned int segment;
+  SUBOOL ok;
+
+  ok = xsig_render_worker_init(worker);
+
+  while (ok) {
+    pthread_mutex_lock(&job->lock);
+    segment = job->failed ? job->segments : job->next++;
+    pthread_mutex_unlock(&job->lock);
+
+    if (segment >= job->segments)
+      break;
+
+    ok = xsig_render_worker_segment(worker, segment);
+  }
+
+  if (!ok) {
+    pthread_mutex_lock(&job->lock);
+    job->failed = SU_TRUE;
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  xsig_render_worker_finalize(worker);
+
+  return NULL;
+}
+
+SUBOOL
+xsig_render(const struct xsig_render_params *params)
+{
+  struct xsig_render_job job;
+  struct xsig_render_worker *workers = NULL;
+  unsigned int threads = params->threads;
+  long online;
+  unsigned int started = 0;
+  unsigned int i;
+  SNDFILE *sf;
+  SF_INFO info;
+  SUFLOAT frame_rate;
+  SUBOOL ok = SU_FALSE;
+
+  assert(params->file != NULL);
+  assert(params->output != NULL);
+  assert(params->fft_size > 0);
+  assert(params->range > 0);
+
+  memset(&job, 0, sizeof (struct xsig_render_job));
+
+  /* Only the length and sample rate are needed here */
+  if ((sf = xsig_render_open(params, &info)) == NULL)
+    return SU_FALSE;
+
+  sf_close(sf);
+
+  frame_rate = (SUFLOAT) info.samplerate / params->fft_size;
+
+  job.params = params;
+  job.frames_per_row =
+      params->row_rate > 0 && frame_rate > params->row_rate
+      ? (uint64_t) (frame_rate / params->row_rate + .5)
+      : 1;
+  job.rows = info.frames / (job.frames_per_row * params->fft_size);
+
+  if (job.rows == 0) {
+    SU_ERROR("`%s': capture too short for a single row\n", params->file);
+    return SU_FALSE;
+  }
+
+  /* struct draw sizes the bitmap with an int */
+  if (job.rows > INT_MAX / BITMAP_ROW_BYTES(params->fft_size * 24)) {
+    SU_ERROR(
+        "`%s': capture too long, %llu rows don't fit in a BMP\n",
+        params->file,
+        (unsigned long long) job.rows);
+    return SU_FALSE;
+  }
+
+  if ((job.cmap = colormap_builtin(params->colormap)) == NULL)
+    return SU_FALSE;
+
+  if (threads == 0) {
+    /* sysconf returns -1 if it can't tell */
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online < 1 ? 1 : online;
+  }
+
+  job.segments = MIN(job.rows, threads * XSIG_RENDER_SEGMENTS_PER_THREAD);
+  threads = MIN(threads, job.segments);
+
+  if ((workers = calloc(threads, sizeof (struct xsig_render_worker))) == NULL)
+    return SU_FALSE;
+
+  pthread_mutex_init(&job.lock, NULL);
+
+  job.image = draw_new(params->fft_size, job.rows);
+
+  for (started = 0; started < threads; ++started) {
+    workers[started].job = &job;
+    if (pthread_create(
+        &workers[started].thread,
+        NULL,
+        xsig_render_worker_thread,
+        &workers[started]) != 0) {
+      SU_ERROR("cannot create render thread\n");
+      pthread_mutex_lock(&job.lock);
+      job.failed = SU_TRUE;
+      pthread_mutex_unlock(&job.lock);
+      break;
+    }
+  }
+
+  for (i = 0; i < started; ++i)
+    pthread_join(workers[i].thread, NULL);
+
+  if (!job.failed)
+    ok = draw_to_bmp(params->output, job.image) == 0;
+
+  draw_free(job.image);
+  pthread_mutex_destroy(&job.lock);
+  free(workers);
+
+  return ok;
+}
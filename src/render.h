@@ -0,0 +1,55 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _RENDER_H
+#define _RENDER_H
+
+#include <sigutils/sigutils.h>
+#include "waterfall.h"
+
+#define XSIG_RENDER_SEGMENTS_PER_THREAD 4 /* Evens out uneven workers */
+
+/*
+ * Offline spectrogram of a whole capture, one FFT bin per column and
+ * one row per frames_per_row FFT frames, oldest row on top.
+ */
+struct xsig_render_params {
+  const char *file;
+  const char *output;    /* BMP file */
+  SUBOOL raw_iq;
+  unsigned int samp_rate; /* Only for raw I/Q files */
+  unsigned int fft_size;
+  SUFLOAT row_rate;      /* Rows per second, 0 for one row per frame */
+  enum xsig_waterfall_reduce reduce;
+  SUFLOAT ref;           /* dBFS at the top of the colormap */
+  SUFLOAT range;         /* dB between the top and the bottom */
+  enum colormap_type colormap;
+  unsigned int threads;  /* 0 for one per online CPU */
+};
+
+#define xsig_render_params_INITIALIZER                  \
+{                                                       \
+  NULL, NULL, SU_FALSE, 250000, 512, 25,                \
+  XSIG_WATERFALL_REDUCE_MAX, 0, 100, COLORMAP_VIRIDIS, 0 \
+}
+
+SUBOOL xsig_render(const struct xsig_render_params *params);
+
+#endif /* _RENDER_H */
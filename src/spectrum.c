@@ -34,6 +34,12 @@ xsig_spectrum_destroy(xsig_spectrum_t *s) {
   if (s->fft != NULL)
     free(s->fft);
 
+  if (s->trace != NULL)
+    free(s->trace);
+
+  if (s->background != NULL)
+    sprite_free(s->background);
+
   free(s);
 }
 
@@ -54,6 +60,9 @@ xsig_spectrum_new(const struct xsig_spectrum_params *params) {
   if ((new->fft = calloc(params->width, sizeof (SUFLOAT))) == NULL)
     goto fail;
 
+  if ((new->trace = calloc(params->width, sizeof (int))) == NULL)
+    goto fail;
+
   new->params = *params;
 
   return new;
@@ -65,6 +74,13 @@ fail:
   return NULL;
 }
 
+void
+xsig_spectrum_set_noise_floor(
+    xsig_spectrum_t *s,
+    const xsig_noise_floor_t *floor)
+{
+  s->floor = floor;
+}
 
 void
 xsig_spectrum_feed(xsig_spectrum_t *s, const SUCOMPLEX *x) {
@@ -92,15 +108,45 @@ xsig_spectrum_feed(xsig_spectrum_t *s, const SUCOMPLEX *x) {
 #define SIGNAL_ALPHA .25
 #define THRESHOLD_ALPHA  .5
 
-void
-xsig_spectrum_redraw(const xsig_spectrum_t *s, display_t *disp)
+/* Values out of the plot are clamped, segments fully out are skipped */
+SUPRIVATE void
+xsig_spectrum_draw_trace(
+    const xsig_spectrum_t *s,
+    display_t *disp,
+    Uint32 color)
 {
-  int i, j, old_j;
-  int x, y_1, y_2;
+  polyline_y(
+      disp,
+      s->params.x,
+      s->params.y,
+      s->trace,
+      s->params.width,
+      s->params.height,
+      color);
+}
+
+SUPRIVATE void
+xsig_spectrum_draw_floor(xsig_spectrum_t *s, display_t *disp)
+{
+  int i;
   unsigned int halfsize = s->params.fft_size / 2;
-  SUFLOAT K = 1. / s->params.fft_size;
-  SUFLOAT dBFS;
+  unsigned int bin;
+
+  for (i = 0; i < s->params.width; ++i) {
+    bin = (i * s->params.fft_size / s->params.width + halfsize)
+        % s->params.fft_size;
+
+    s->trace[i] = s->params.height * s->params.scale
+            * (1. - xsig_noise_floor_dbfs(s->floor, bin) + s->params.ref);
+  }
+
+  xsig_spectrum_draw_trace(s, disp, OPAQUE(0x3f3f9f));
+}
 
+/* Frame and cleared plot area, drawn once and then copied back */
+SUPRIVATE void
+xsig_spectrum_draw_background(xsig_spectrum_t *s, display_t *disp)
+{
   box(
       disp,
       s->params.x,
@@ -117,36 +163,38 @@ xsig_spectrum_redraw(const xsig_spectrum_t *s, display_t *disp)
       s->params.y + s->params.height,
       OPAQUE(0x000000));
 
+  s->background = sprite_grab(
+      disp,
+      s->params.x,
+      s->params.y,
+      s->params.width + 2,
+      s->params.height + 2);
+}
+
+void
+xsig_spectrum_redraw(xsig_spectrum_t *s, display_t *disp)
+{
+  int i;
+  unsigned int halfsize = s->params.fft_size / 2;
+  SUFLOAT K = 1. / s->params.fft_size;
+  SUFLOAT dBFS;
+
+  if (s->background == NULL)
+    xsig_spectrum_draw_background(s, disp);
+  else
+    sprite_put(disp, s->params.x, s->params.y, s->background);
+
+  if (s->floor != NULL)
+    xsig_spectrum_draw_floor(s, disp);
+
   for (i = 0; i < s->params.width; ++i) {
     /* TODO: Adjust FFT index to width */
     dBFS = SU_DB_RAW(s->fft[(i + halfsize) % s->params.fft_size] * K);
 
-    j = s->params.height * s->params.scale
+    s->trace[i] = s->params.height * s->params.scale
             * (1. - dBFS + s->params.ref);
-
-    if (i > 0)
-      if ((j > 0 && j < s->params.height)
-          || (old_j > 0 && old_j < s->params.height)) {
-        y_1 = j < 0
-            ? 0
-            : (j >= s->params.height
-                ? s->params.height - 1
-                : j);
-
-        y_2 = old_j < 0
-            ? 0
-            : (old_j >= s->params.height
-                ? s->params.height - 1
-                : old_j);
-        line(
-            disp,
-            s->params.x + i,
-            s->params.y + y_1,
-            s->params.x + i - 1,
-            s->params.y + y_2,
-            OPAQUE(0x00ff00));
-      }
-    old_j = j;
   }
+
+  xsig_spectrum_draw_trace(s, disp, OPAQUE(0x00ff00));
 }
 
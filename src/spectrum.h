@@ -22,6 +22,7 @@
 #define _SPECTRUM_H
 
 #include <sigutils/sigutils.h>
+#include "noisefloor.h"
 
 struct xsig_spectrum_params {
   unsigned int fft_size;
@@ -37,13 +38,19 @@ struct xsig_spectrum_params {
 struct xsig_spectrum {
   struct xsig_spectrum_params params;
   SUFLOAT *fft;
+  int *trace; /* Row of every column, handed to polyline_y */
+  const xsig_noise_floor_t *floor; /* optional, drawn below the trace */
+  struct sprite *background; /* Frame and plot area, saved on first redraw */
 };
 
 typedef struct xsig_spectrum xsig_spectrum_t;
 
 void xsig_spectrum_destroy(xsig_spectrum_t *s);
 xsig_spectrum_t *xsig_spectrum_new(const struct xsig_spectrum_params *params);
+void xsig_spectrum_set_noise_floor(
+    xsig_spectrum_t *s,
+    const xsig_noise_floor_t *floor);
 void xsig_spectrum_feed(xsig_spectrum_t *s, const SUCOMPLEX *fft);
-void xsig_spectrum_redraw(const xsig_spectrum_t *s, display_t *disp);
+void xsig_spectrum_redraw(xsig_spectrum_t *s, display_t *disp);
 
 #endif /* _SPECTRUM_H */
@@ -0,0 +1,276 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <xsigtool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "spill.h"
+
+SUPRIVATE void
+xsig_spill_unmap(xsig_spill_t *spill)
+{
+  if (spill->map != NULL) {
+    munmap(spill->map, spill->map_len);
+    spill->map = NULL;
+    spill->map_rows = NULL;
+    spill->map_count = 0;
+  }
+}
+
+void
+xsig_spill_destroy(xsig_spill_t *spill) {
+  assert(spill != NULL);
+
+  xsig_spill_unmap(spill);
+
+  if (spill->fd != -1)
+    close(spill->fd);
+
+  if (spill->idx_fd != -1)
+    close(spill->idx_fd);
+
+  if (spill->record != NULL)
+    free(spill->record);
+
+  if (spill->params.path != NULL)
+    free((void *) spill->params.path);
+
+  free(spill);
+}
+
+xsig_spill_t *
+xsig_spill_new(const struct xsig_spill_params *params) {
+  xsig_spill_t *new = NULL;
+  char *idx_path = NULL;
+
+  assert(params != NULL);
+  assert(params->path != NULL);
+  assert(params->width > 0);
+  assert(params->depth == 8 || params->depth == 16);
+
+  if ((new = calloc(1, sizeof (xsig_spill_t))) == NULL)
+    goto fail;
+
+  new->fd = -1;
+  new->idx_fd = -1;
+  new->params = *params;
+
+  if ((new->params.path = strdup(params->path)) == NULL)
+    goto fail;
+
+  if ((new->fd = open(
+      params->path,
+      O_RDWR | O_CREAT | O_TRUNC,
+      0644)) == -1) {
+    SU_ERROR("cannot open spill file `%s': %s\n", params->path, strerror(errno));
+    goto fail;
+  }
+
+  idx_path = strbuild("%s%s", params->path, XSIG_SPILL_INDEX_SUFFIX);
+
+  if ((new->idx_fd = open(idx_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+    SU_ERROR("cannot open spill index `%s': %s\n", idx_path, strerror(errno));
+    goto fail;
+  }
+
+  memcpy(new->header.magic, XSIG_SPILL_MAGIC, sizeof (new->header.magic));
+  new->header.width = params->width;
+  new->header.depth = params->depth;
+  new->header.record_size = __ALIGN(
+      sizeof (struct xsig_spill_record)
+      + params->width * (params->depth >> 3),
+      sizeof (double));
+
+  if ((new->record = calloc(1, new->header.record_size)) == NULL)
+    goto fail;
+
+  if (pwrite(new->fd, &new->header, sizeof (struct xsig_spill_header), 0)
+      != sizeof (struct xsig_spill_header)) {
+    SU_ERROR("cannot write spill header: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  free(idx_path);
+
+  return new;
+
+fail:
+  if (idx_path != NULL)
+    free(idx_path);
+
+  if (new != NULL)
+    xsig_spill_destroy(new);
+
+  return NULL;
+}
+
+SUBOOL
+xsig_spill_append(
+    xsig_spill_t *spill,
+    double time,
+    SUFLOAT offset,
+    SUFLOAT scale,
+    const void *samples)
+{
+  struct xsig_spill_record *record;
+  uint64_t second;
+  off_t pos;
+
+  if (spill->rows == 0) {
+    spill->header.t0 = time;
+    if (pwrite(spill->fd, &spill->header, sizeof (struct xsig_spill_header), 0)
+        != sizeof (struct xsig_spill_header)) {
+      SU_ERROR("cannot update spill header: %s\n", strerror(errno));
+      return SU_FALSE;
+    }
+  }
+
+  record = (struct xsig_spill_record *) spill->record;
+  record->time = time;
+  record->offset = offset;
+  record->scale = scale;
+  memcpy(record + 1, samples, spill->params.width * (spill->params.depth >> 3));
+
+  pos = sizeof (struct xsig_spill_header)
+      + (off_t) spill->rows * spill->header.record_size;
+
+  if (pwrite(spill->fd, record, spill->header.record_size, pos)
+      != spill->header.record_size) {
+    SU_ERROR("cannot append to spill file: %s\n", strerror(errno));
+    return SU_FALSE;
+  }
+
+  /* Every second up to this one now starts at this row at the latest */
+  second = time > spill->header.t0 ? time - spill->header.t0 : 0;
+
+  for (; spill->seconds <= second; ++spill->seconds)
+    if (pwrite(
+        spill->idx_fd,
+        &spill->rows,
+        sizeof (uint64_t),
+        spill->seconds * sizeof (uint64_t)) != sizeof (uint64_t)) {
+      SU_ERROR("cannot update spill index: %s\n", strerror(errno));
+      return SU_FALSE;
+    }
+
+  ++spill->rows;
+
+  return SU_TRUE;
+}
+
+/* Map a window of rows around `row', limited to what is on disk */
+SUPRIVATE SUBOOL
+xsig_spill_map(xsig_spill_t *spill, uint64_t row)
+{
+  uint64_t first;
+  uint64_t count;
+  off_t pos;
+  off_t base;
+  long page = sysconf(_SC_PAGESIZE);
+
+  xsig_spill_unmap(spill);
+
+  first = row > XSIG_SPILL_WINDOW_ROWS / 2 ? row - XSIG_SPILL_WINDOW_ROWS / 2 : 0;
+  count = MIN(XSIG_SPILL_WINDOW_ROWS, spill->rows - first);
+
+  pos = sizeof (struct xsig_spill_header)
+      + (off_t) first * spill->header.record_size;
+  base = pos & ~((off_t) page - 1);
+
+  spill->map_len = pos - base + count * spill->header.record_size;
+
+  if ((spill->map = mmap(
+      NULL,
+      spill->map_len,
+      PROT_READ,
+      MAP_SHARED,
+      spill->fd,
+      base)) == MAP_FAILED) {
+    SU_ERROR("cannot map spill file: %s\n", strerror(errno));
+    spill->map = NULL;
+    return SU_FALSE;
+  }
+
+  spill->map_rows = (const uint8_t *) spill->map + (pos - base);
+  spill->map_first = first;
+  spill->map_count = count;
+
+  return SU_TRUE;
+}
+
+const struct xsig_spill_record *
+xsig_spill_get(xsig_spill_t *spill, uint64_t row)
+{
+  if (row >= spill->rows)
+    return NULL;
+
+  if (spill->map == NULL
+      || row < spill->map_first
+      || row >= spill->map_first + spill->map_count)
+    if (!xsig_spill_map(spill, row))
+      return NULL;
+
+  return (const struct xsig_spill_record *)
+      (spill->map_rows
+          + (row - spill->map_first) * spill->header.record_size);
+}
+
+/* First row at or after `time' (last row if none) */
+uint64_t
+xsig_spill_find(xsig_spill_t *spill, double time)
+{
+  uint64_t second;
+  uint64_t row;
+
+  if (spill->rows == 0 || time <= spill->header.t0)
+    return 0;
+
+  second = time - spill->header.t0;
+
+  if (second >= spill->seconds)
+    return spill->rows - 1;
+
+  if (pread(
+      spill->idx_fd,
+      &row,
+      sizeof (uint64_t),
+      second * sizeof (uint64_t)) != sizeof (uint64_t)) {
+    SU_ERROR("cannot read spill index: %s\n", strerror(errno));
+    return spill->rows - 1;
+  }
+
+  return row;
+}
+
+double
+xsig_spill_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
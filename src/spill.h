@@ -0,0 +1,106 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SPILL_H
+#define _SPILL_H
+
+#include <stdint.h>
+#include <sigutils/sigutils.h>
+
+#define XSIG_SPILL_MAGIC "XSIGSPL1"
+#define XSIG_SPILL_INDEX_SUFFIX ".idx"
+#define XSIG_SPILL_WINDOW_ROWS 4096 /* Rows mapped at once for reading */
+
+/*
+ * Append-only log of quantized waterfall rows. The data file is a
+ * header followed by fixed-size records, so row n is at a known
+ * offset. A companion index file stores, for every second since the
+ * first row, the number of the first row at or after that second.
+ * Together they make looking up a row by number or by time O(1).
+ * Reads go through a window of XSIG_SPILL_WINDOW_ROWS rows mapped on
+ * demand, so memory use does not depend on the length of the log.
+ */
+struct xsig_spill_header {
+  char     magic[8];
+  uint32_t width;
+  uint32_t depth;       /* Bits per sample, 8 or 16 */
+  uint32_t record_size; /* Bytes per record, record header included */
+  uint32_t reserved;
+  double   t0;          /* Time of the first row */
+};
+
+struct xsig_spill_record {
+  double time;
+  double offset;
+  double scale;
+  /* width samples of depth bits follow */
+};
+
+struct xsig_spill_params {
+  const char *path;
+  unsigned int width;
+  unsigned int depth;
+};
+
+typedef struct xsig_spill {
+  struct xsig_spill_params params;
+  struct xsig_spill_header header;
+  int fd;
+  int idx_fd;
+  uint64_t rows;      /* Records in the log */
+  uint64_t seconds;   /* Entries in the index */
+  uint8_t *record;    /* Scratch record for appends */
+
+  /* Read window */
+  void *map;
+  size_t map_len;
+  const uint8_t *map_rows; /* Address of record map_first */
+  uint64_t map_first;
+  uint64_t map_count;
+}
+xsig_spill_t;
+
+void xsig_spill_destroy(xsig_spill_t *spill);
+xsig_spill_t *xsig_spill_new(const struct xsig_spill_params *params);
+SUBOOL xsig_spill_append(
+    xsig_spill_t *spill,
+    double time,
+    SUFLOAT offset,
+    SUFLOAT scale,
+    const void *samples);
+const struct xsig_spill_record *xsig_spill_get(
+    xsig_spill_t *spill,
+    uint64_t row);
+uint64_t xsig_spill_find(xsig_spill_t *spill, double time);
+double xsig_spill_now(void);
+
+static inline uint64_t
+xsig_spill_rows(const xsig_spill_t *spill)
+{
+  return spill->rows;
+}
+
+static inline const void *
+xsig_spill_samples(const struct xsig_spill_record *record)
+{
+  return record + 1;
+}
+
+#endif /* _SPILL_H */
@@ -0,0 +1,100 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#include <xsigtool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "symstats.h"
+
+void
+xsig_symstats_init(xsig_symstats_t *stats, SUFLOAT alpha)
+{
+  assert(alpha > 0 && alpha <= 1);
+
+  memset(stats, 0, sizeof (xsig_symstats_t));
+
+  stats->beta = 1 - alpha;
+}
+
+/*
+ * With centroid c and mean power m of a quadrant, the mean squared
+ * error against its ideal point r is m - 2 Re(c r*) + |r|^2, so the
+ * error power follows from the sums without revisiting any symbol.
+ */
+void
+xsig_symstats_report(
+    const xsig_symstats_t *stats,
+    struct xsig_symstats_report *report)
+{
+  unsigned int k;
+  SUFLOAT total = 0;
+  SUFLOAT amp = 0;
+  SUFLOAT err = 0;
+  SUFLOAT phase = 0;
+  SUFLOAT phase2 = 0;
+  SUFLOAT power[XSIG_SYMSTATS_QUADRANTS];
+  SUCOMPLEX ideal;
+
+  memset(report, 0, sizeof (struct xsig_symstats_report));
+
+  report->count = stats->count;
+
+  for (k = 0; k < XSIG_SYMSTATS_QUADRANTS; ++k) {
+    power[k] = 0;
+
+    if (stats->weight[k] > 0) {
+      report->centroid[k] =
+          (stats->sum_i[k] + I * stats->sum_q[k]) / stats->weight[k];
+      power[k] = stats->sum_pow[k] / stats->weight[k];
+      report->variance[k] = power[k]
+          - SU_C_ABS(report->centroid[k]) * SU_C_ABS(report->centroid[k]);
+
+      total  += stats->weight[k];
+      amp    += stats->weight[k] * SU_C_ABS(report->centroid[k]);
+      phase  += stats->sum_phase[k];
+      phase2 += stats->sum_phase2[k];
+    }
+  }
+
+  if (total <= 0)
+    return;
+
+  amp /= total;
+
+  for (k = 0; k < XSIG_SYMSTATS_QUADRANTS; ++k)
+    if (stats->weight[k] > 0) {
+      ideal = amp * M_SQRT1_2 * ((k & 2 ? 1 : -1) + I * (k & 1 ? 1 : -1));
+      err += stats->weight[k] * (
+          power[k]
+          - 2 * SU_C_REAL(report->centroid[k] * SU_C_CONJ(ideal))
+          + amp * amp);
+    }
+
+  err /= total;
+
+  if (err > 0 && amp > 0) {
+    report->evm = 100 * SU_SQRT(err) / amp;
+    report->mer = SU_POWER_DB_RAW(amp * amp / err);
+  }
+
+  report->phase_mean = phase / total * 180 / M_PI;
+  report->phase_rms = SU_SQRT(phase2 / total) * 180 / M_PI;
+}
@@ -0,0 +1,104 @@
+/*
+
+  Copyright (C) 2016 Gonzalo José Carracedo Carballal
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program.  If not, see
+  <http://www.gnu.org/licenses/>
+
+*/
+
+#ifndef _SYMSTATS_H
+#define _SYMSTATS_H
+
+#include <stdint.h>
+#include <sigutils/sigutils.h>
+
+#define XSIG_SYMSTATS_QUADRANTS 4
+
+/*
+ * Running QPSK quality metrics. Symbols are assigned to the nearest
+ * ideal point (their quadrant). Every quadrant keeps exponentially
+ * weighted sums, stored as structure of arrays with one lane per
+ * quadrant so the per-symbol decay is a short vector loop. The ideal
+ * amplitude is the mean centroid magnitude, so no AGC reference is
+ * needed. All ratios are worked out only when a report is requested.
+ */
+typedef struct xsig_symstats {
+  SUFLOAT beta;  /* 1 - alpha, per-symbol decay of the sums */
+  SUFLOAT weight[XSIG_SYMSTATS_QUADRANTS];
+  SUFLOAT sum_i[XSIG_SYMSTATS_QUADRANTS];
+  SUFLOAT sum_q[XSIG_SYMSTATS_QUADRANTS];
+  SUFLOAT sum_pow[XSIG_SYMSTATS_QUADRANTS];   /* |s|^2 */
+  SUFLOAT sum_phase[XSIG_SYMSTATS_QUADRANTS]; /* Phase error, radians */
+  SUFLOAT sum_phase2[XSIG_SYMSTATS_QUADRANTS];
+  uint64_t count;
+}
+xsig_symstats_t;
+
+struct xsig_symstats_report {
+  uint64_t count;
+  SUFLOAT evm;         /* RMS error vector, % of the ideal amplitude */
+  SUFLOAT mer;         /* Modulation error ratio, dB */
+  SUFLOAT phase_rms;   /* Degrees */
+  SUFLOAT phase_mean;  /* Degrees */
+  SUCOMPLEX centroid[XSIG_SYMSTATS_QUADRANTS];
+  SUFLOAT variance[XSIG_SYMSTATS_QUADRANTS];
+};
+
+void xsig_symstats_init(xsig_symstats_t *stats, SUFLOAT alpha);
+void xsig_symstats_report(
+    const xsig_symstats_t *stats,
+    struct xsig_symstats_report *report);
+
+/* Same numbering as the symbols printed by xsigtool */
+static inline unsigned int
+xsig_symstats_quadrant(SUCOMPLEX s)
+{
+  return ((SU_C_REAL(s) > 0) << 1) | (SU_C_IMAG(s) > 0);
+}
+
+static inline void
+xsig_symstats_feed(xsig_symstats_t *stats, SUCOMPLEX s)
+{
+  unsigned int k;
+  unsigned int q = xsig_symstats_quadrant(s);
+  SUFLOAT re = SU_C_REAL(s);
+  SUFLOAT im = SU_C_IMAG(s);
+  SUFLOAT phase;
+
+  /* Angle to the quadrant diagonal, re and im signs folded away */
+  phase = SU_ATAN2(SU_ABS(im), SU_ABS(re)) - M_PI / 4;
+  if ((re > 0) != (im > 0))
+    phase = -phase;
+
+  for (k = 0; k < XSIG_SYMSTATS_QUADRANTS; ++k) {
+    stats->weight[k]     *= stats->beta;
+    stats->sum_i[k]      *= stats->beta;
+    stats->sum_q[k]      *= stats->beta;
+    stats->sum_pow[k]    *= stats->beta;
+    stats->sum_phase[k]  *= stats->beta;
+    stats->sum_phase2[k] *= stats->beta;
+  }
+
+  stats->weight[q]     += 1;
+  stats->sum_i[q]      += re;
+  stats->sum_q[q]      += im;
+  stats->sum_pow[q]    += re * re + im * im;
+  stats->sum_phase[q]  += phase;
+  stats->sum_phase2[q] += phase * phase;
+
+  ++stats->count;
+}
+
+#endif /* _SYMSTATS_H */
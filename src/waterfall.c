@@ -20,50 +20,101 @@
 
 #include <xsigtool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "waterfall.h"
 
+/* Fraction of the displayed range above black where the noise floor sits */
+#define XSIG_WATERFALL_FLOOR_LEVEL .15
+
 void
 xsig_waterfall_destroy(xsig_waterfall_t *wf) {
-  unsigned int i;
-
   assert(wf != NULL);
 
-  if (wf->history != NULL) {
-    for (i = 0; i < wf->params.height; ++i)
-      if (wf->history[i] != NULL)
-        free(wf->history[i]);
-
+  if (wf->history != NULL)
     free(wf->history);
-  }
+
+  if (wf->offset != NULL)
+    free(wf->offset);
+
+  if (wf->scale != NULL)
+    free(wf->scale);
+
+  if (wf->scratch != NULL)
+    free(wf->scratch);
+
+  if (wf->acc != NULL)
+    free(wf->acc);
+
+  if (wf->pixels != NULL)
+    free(wf->pixels);
 
   free(wf);
 }
 
+SUPRIVATE uint8_t *
+xsig_waterfall_alloc_history(unsigned int stride, unsigned int height)
+{
+  void *history;
+
+  if (posix_memalign(&history, XSIG_WATERFALL_ALIGN, height * stride) != 0)
+    return NULL;
+
+  memset(history, 0, height * stride);
+
+  return history;
+}
+
 xsig_waterfall_t *
 xsig_waterfall_new(const struct xsig_waterfall_params *params) {
   xsig_waterfall_t *new = NULL;
-  unsigned int i;
 
   assert(params != NULL);
   assert(params->fft_size > 0);
   assert(params->width > 0);
   assert(params->height > 0);
+  assert(params->depth == 8 || params->depth == 16);
+  assert(params->range > 0);
 
   if ((new = calloc(1, sizeof(xsig_waterfall_t))) == NULL)
     goto fail;
 
-  if ((new->history = malloc(params->height * sizeof (SUCOMPLEX))) == NULL)
+  /* Every row starts on a cache line boundary */
+  new->stride = __ALIGN(
+      params->width * (params->depth >> 3),
+      XSIG_WATERFALL_ALIGN);
+
+  if ((new->history = xsig_waterfall_alloc_history(
+      new->stride,
+      params->height)) == NULL)
+    goto fail;
+
+  if ((new->offset = calloc(params->height, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((new->scale = calloc(params->height, sizeof (SUFLOAT))) == NULL)
     goto fail;
 
-  for (i = 0; i < params->height; ++i)
-    if ((new->history[i] = calloc(params->width, sizeof (SUFLOAT))) == NULL)
-      goto fail;
+  if ((new->scratch = calloc(params->width, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((new->acc = calloc(params->width, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((new->pixels = calloc(
+      params->width * params->height,
+      sizeof (Uint32))) == NULL)
+    goto fail;
+
+  if ((new->cmap = colormap_builtin(COLORMAP_GRAYSCALE)) == NULL)
+    goto fail;
 
   new->params = *params;
   new->k = 0.5;
 
+  xsig_waterfall_set_row_rate(new, params->row_rate);
+
   return new;
 
 fail:
@@ -73,6 +124,331 @@ fail:
   return NULL;
 }
 
+void
+xsig_waterfall_set_noise_floor(
+    xsig_waterfall_t *wf,
+    const xsig_noise_floor_t *floor)
+{
+  wf->floor = floor;
+}
+
+/* Switching colormaps recolorizes the whole history on next redraw */
+void
+xsig_waterfall_set_colormap(
+    xsig_waterfall_t *wf,
+    const struct colormap *cmap)
+{
+  if (cmap != wf->cmap) {
+    wf->cmap = cmap;
+    wf->pending = wf->params.height;
+  }
+}
+
+/*
+ * Frames come at samp_rate / fft_size per second. Asking for more rows
+ * than that (or for 0) gives one row per frame.
+ */
+void
+xsig_waterfall_set_row_rate(xsig_waterfall_t *wf, SUFLOAT row_rate)
+{
+  SUFLOAT frame_rate = wf->params.samp_rate / wf->params.fft_size;
+
+  wf->params.row_rate = row_rate;
+
+  if (row_rate > 0 && frame_rate > row_rate)
+    wf->frames_per_row = frame_rate / row_rate + .5;
+  else
+    wf->frames_per_row = 1;
+
+  wf->frames = 0;
+}
+
+void
+xsig_waterfall_set_spill(xsig_waterfall_t *wf, xsig_spill_t *spill)
+{
+  assert(spill == NULL || spill->params.width == wf->params.width);
+  assert(spill == NULL || spill->params.depth == wf->params.depth);
+
+  wf->spill = spill;
+}
+
+/*
+ * Leaving scrollback recolorizes the live history, as the scrollback
+ * view reuses its pixel buffer.
+ */
+void
+xsig_waterfall_live(xsig_waterfall_t *wf)
+{
+  if (wf->scrollback) {
+    wf->scrollback = SU_FALSE;
+    wf->pending = wf->params.height;
+  }
+}
+
+/*
+ * Move the view `rows' rows into the past (or into the future, if
+ * negative). The view is anchored to spill rows, so it stays put while
+ * new rows keep arriving. Scrolling past the newest row goes live.
+ */
+void
+xsig_waterfall_scroll(xsig_waterfall_t *wf, int64_t rows)
+{
+  uint64_t total;
+  uint64_t oldest;
+  int64_t end;
+
+  if (wf->spill == NULL)
+    return;
+
+  total = xsig_spill_rows(wf->spill);
+  oldest = MIN(wf->params.height, total);
+  end = (wf->scrollback ? wf->view_end : total) - rows;
+
+  if (end >= (int64_t) total) {
+    xsig_waterfall_live(wf);
+    return;
+  }
+
+  wf->view_end = MAX(end, (int64_t) oldest);
+  wf->scrollback = SU_TRUE;
+}
+
+/* Show the row closest to `time' at the top of the view */
+void
+xsig_waterfall_scroll_to_time(xsig_waterfall_t *wf, double time)
+{
+  uint64_t row;
+
+  if (wf->spill == NULL || xsig_spill_rows(wf->spill) == 0)
+    return;
+
+  row = xsig_spill_find(wf->spill, time);
+
+  wf->scrollback = SU_TRUE;
+  wf->view_end = row + wf->params.height;
+  xsig_waterfall_scroll(wf, 0);
+}
+
+/* Copy the `keep' most recent of `height' ring entries, oldest first */
+SUPRIVATE void
+xsig_waterfall_unroll(
+    void *dest,
+    const void *src,
+    size_t size,
+    unsigned int ptr,
+    unsigned int height,
+    unsigned int keep)
+{
+  unsigned int first = (ptr + height - keep) % height;
+  unsigned int tail = MIN(keep, height - first);
+
+  memcpy(dest, (const uint8_t *) src + first * size, tail * size);
+
+  if (tail < keep)
+    memcpy((uint8_t *) dest + tail * size, src, (keep - tail) * size);
+}
+
+/*
+ * Keeps the most recent rows. The ring is unrolled while copying, so
+ * this takes at most two memcpy calls per array.
+ */
+SUBOOL
+xsig_waterfall_set_height(xsig_waterfall_t *wf, unsigned int height)
+{
+  uint8_t *history = NULL;
+  SUFLOAT *offset = NULL;
+  SUFLOAT *scale = NULL;
+  Uint32 *pixels = NULL;
+  unsigned int keep;
+
+  assert(height > 0);
+
+  if (height == wf->params.height)
+    return SU_TRUE;
+
+  if ((history = xsig_waterfall_alloc_history(wf->stride, height)) == NULL)
+    goto fail;
+
+  if ((offset = calloc(height, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((scale = calloc(height, sizeof (SUFLOAT))) == NULL)
+    goto fail;
+
+  if ((pixels = calloc(wf->params.width * height, sizeof (Uint32))) == NULL)
+    goto fail;
+
+  keep = MIN(height, wf->params.height);
+
+  xsig_waterfall_unroll(
+      history,
+      wf->history,
+      wf->stride,
+      wf->ptr,
+      wf->params.height,
+      keep);
+  xsig_waterfall_unroll(
+      offset,
+      wf->offset,
+      sizeof (SUFLOAT),
+      wf->ptr,
+      wf->params.height,
+      keep);
+  xsig_waterfall_unroll(
+      scale,
+      wf->scale,
+      sizeof (SUFLOAT),
+      wf->ptr,
+      wf->params.height,
+      keep);
+
+  free(wf->history);
+  free(wf->offset);
+  free(wf->scale);
+  free(wf->pixels);
+
+  wf->history = history;
+  wf->offset = offset;
+  wf->scale = scale;
+  wf->pixels = pixels;
+  wf->params.height = height;
+  wf->ptr = keep % height;
+  wf->pending = keep; /* Colors are rebuilt on next redraw */
+  wf->frame = 0;      /* And so is the frame */
+
+  return SU_TRUE;
+
+fail:
+  if (history != NULL)
+    free(history);
+
+  if (offset != NULL)
+    free(offset);
+
+  if (scale != NULL)
+    free(scale);
+
+  return SU_FALSE;
+}
+
+SUPRIVATE void
+xsig_waterfall_advance(xsig_waterfall_t *wf)
+{
+  if (++wf->ptr == wf->params.height)
+    wf->ptr = 0;
+
+  if (wf->pending < wf->params.height)
+    ++wf->pending;
+}
+
+/*
+ * Quantizes a row of magnitudes into the next history row. The row's
+ * own dB span is mapped onto all the available levels.
+ */
+SUPRIVATE void
+xsig_waterfall_quantize(xsig_waterfall_t *wf, const SUFLOAT *mag)
+{
+  unsigned int i;
+  unsigned int levels = (1 << wf->params.depth) - 1;
+  SUFLOAT *dB = wf->scratch;
+  SUFLOAT lo = INFINITY;
+  SUFLOAT hi = -INFINITY;
+  SUFLOAT scale, inv;
+  uint8_t *row8;
+  uint16_t *row16;
+
+  for (i = 0; i < wf->params.width; ++i) {
+    dB[i] = SU_DB_RAW(MAX(mag[i], XSIG_WATERFALL_MIN_MAG));
+
+    if (dB[i] < lo)
+      lo = dB[i];
+
+    if (dB[i] > hi)
+      hi = dB[i];
+  }
+
+  scale = hi > lo ? (hi - lo) / levels : 1;
+  inv = 1. / scale;
+
+  if (wf->params.depth == 8) {
+    row8 = xsig_waterfall_row(wf, wf->ptr);
+    for (i = 0; i < wf->params.width; ++i)
+      row8[i] = (dB[i] - lo) * inv + .5;
+  } else {
+    row16 = xsig_waterfall_row(wf, wf->ptr);
+    for (i = 0; i < wf->params.width; ++i)
+      row16[i] = (dB[i] - lo) * inv + .5;
+  }
+
+  wf->offset[wf->ptr] = lo;
+  wf->scale[wf->ptr] = scale;
+
+  if (wf->spill != NULL
+      && !xsig_spill_append(
+          wf->spill,
+          xsig_spill_now(),
+          lo,
+          scale,
+          xsig_waterfall_row(wf, wf->ptr))) {
+    SU_ERROR("spill file disabled\n");
+    wf->spill = NULL;
+    xsig_waterfall_live(wf);
+  }
+
+  xsig_waterfall_advance(wf);
+}
+
+/* Append an already resampled row of `width' magnitudes */
+void
+xsig_waterfall_push(xsig_waterfall_t *wf, const SUFLOAT *row)
+{
+  xsig_waterfall_quantize(wf, row);
+}
+
+/*
+ * Fold a frame into the accumulator. Both reductions are plain
+ * branch-free loops over restrict pointers, so the compiler can
+ * vectorize them.
+ */
+SUPRIVATE void
+xsig_waterfall_reduce(xsig_waterfall_t *wf, const SUFLOAT *frame)
+{
+  unsigned int i;
+  unsigned int width = wf->params.width;
+  SUFLOAT *restrict acc = wf->acc;
+  const SUFLOAT *restrict x = frame;
+
+  if (wf->frames == 0)
+    memcpy(acc, x, width * sizeof (SUFLOAT));
+  else if (wf->params.reduce == XSIG_WATERFALL_REDUCE_MAX)
+    for (i = 0; i < width; ++i)
+      acc[i] = acc[i] > x[i] ? acc[i] : x[i];
+  else
+    for (i = 0; i < width; ++i)
+      acc[i] += x[i];
+
+  ++wf->frames;
+}
+
+/* Turn the accumulated frames into a history row */
+SUPRIVATE void
+xsig_waterfall_commit(xsig_waterfall_t *wf)
+{
+  unsigned int i;
+  unsigned int width = wf->params.width;
+  SUFLOAT *restrict acc = wf->acc;
+  SUFLOAT inv;
+
+  if (wf->params.reduce == XSIG_WATERFALL_REDUCE_MEAN && wf->frames > 1) {
+    inv = 1. / wf->frames;
+    for (i = 0; i < width; ++i)
+      acc[i] *= inv;
+  }
+
+  xsig_waterfall_quantize(wf, acc);
+
+  wf->frames = 0;
+}
 
 void
 xsig_waterfall_feed(xsig_waterfall_t *wf, const SUCOMPLEX *s) {
@@ -81,6 +457,7 @@ xsig_waterfall_feed(xsig_waterfall_t *wf, const SUCOMPLEX *s) {
   SUFLOAT s_index;
   SUFLOAT t;
   SUFLOAT S0 = 0; /* Signal ceiling */
+  SUFLOAT *row = wf->scratch;
 
   for (i = 0; i < wf->params.width; ++i) {
     s_index = (SUFLOAT) i / (SUFLOAT) (wf->params.width - 1)
@@ -91,44 +468,134 @@ xsig_waterfall_feed(xsig_waterfall_t *wf, const SUCOMPLEX *s) {
     if (SU_C_ABS(s[s_i]) > S0)
       S0 = SU_C_ABS(s[s_i]);
 
-    wf->history[wf->ptr][i] =
+    row[i] =
         s_i == wf->params.fft_size - 1
         ? SU_C_ABS(s[s_i])
         : (1. - t) * SU_C_ABS(s[s_i]) + t * SU_C_ABS(s[s_i + 1]);
   }
 
-  if (++wf->ptr == wf->params.height)
-    wf->ptr = 0;
-
-  if (S0 > 0)
+  xsig_waterfall_reduce(wf, row);
+
+  if (wf->frames >= wf->frames_per_row)
+    xsig_waterfall_commit(wf);
+
+  /*
+   * Place the noise floor XSIG_WATERFALL_FLOOR_LEVEL above black. The
+   * target gain is worked out in SU_DB_RAW units, same as the display.
+   */
+  if (wf->floor != NULL)
+    wf->k += 5e-2 * (
+        pow(10,
+            (-(1 - XSIG_WATERFALL_FLOOR_LEVEL) * wf->params.range
+            - .5 * SU_DB_RAW(xsig_noise_floor_level(wf->floor)))
+            / SU_DB_RAW(10.)) - wf->k);
+  else if (S0 > 0)
     wf->k += 5e-2 * (1. / S0 - wf->k);
 }
 
-SUPRIVATE SUFLOAT
-xsig_waterfall_saturation(SUFLOAT x) {
-  if (x > 1)
-    return 1;
+/*
+ * Display is logarithmic: 1 / k sits at the top of the colormap and
+ * `range' dB below it at the bottom. With dB = offset + q * scale this
+ * is linear in q, evaluated in 16.16 fixed point. The gain only
+ * enters through the per-row coefficients, so the history never has to
+ * be requantized.
+ */
+SUPRIVATE void
+xsig_waterfall_colorize(
+    const xsig_waterfall_t *wf,
+    const void *row,
+    SUFLOAT offset,
+    SUFLOAT scale,
+    Uint32 *pixels)
+{
+  unsigned int i;
+  unsigned int halfsize = wf->params.fft_size / 2;
+  const uint8_t *row8 = row;
+  const uint16_t *row16 = row;
+  const struct colormap *cmap = wf->cmap;
+  SUFLOAT top = cmap->size - 1;
+  int64_t a, b;
+
+  a = 65536. * (top
+      * (1 + (offset + SU_DB_RAW(wf->k)) / wf->params.range) + .5);
+  b = 65536. * top * scale / wf->params.range;
 
-  return x;
+  /* TODO: Adjust FFT index to width */
+  if (wf->params.depth == 8)
+    for (i = 0; i < wf->params.width; ++i)
+      pixels[i] = COLOR_MASK & colormap_lookup(
+          cmap,
+          (a + b * row8[(i + halfsize) % wf->params.fft_size]) >> 16);
+  else
+    for (i = 0; i < wf->params.width; ++i)
+      pixels[i] = COLOR_MASK & colormap_lookup(
+          cmap,
+          (a + b * row16[(i + halfsize) % wf->params.fft_size]) >> 16);
 }
 
-static inline int
-calc_color_wf (double idx)
+SUPRIVATE void
+xsig_waterfall_colorize_row(xsig_waterfall_t *wf, unsigned int n)
 {
-  idx = xsig_waterfall_saturation(idx);
+  xsig_waterfall_colorize(
+      wf,
+      xsig_waterfall_row(wf, n),
+      wf->offset[n],
+      wf->scale[n],
+      wf->pixels + n * wf->params.width);
+}
 
-  return RED   ((int) (255.0 * idx))
-        | GREEN ((int) (255.0 * idx))
-        | BLUE  ((int) (255.0 * idx));
+/*
+ * Rows are paged in from the spill file and colorized every time, as
+ * the view may jump anywhere. Rows before the start of the log are
+ * left black.
+ */
+SUPRIVATE void
+xsig_waterfall_redraw_scrollback(xsig_waterfall_t *wf, display_t *disp)
+{
+  unsigned int i;
+  unsigned int blank;
+  const struct xsig_spill_record *record;
+  Uint32 *pixels;
+
+  blank = wf->view_end < wf->params.height
+      ? wf->params.height - wf->view_end
+      : 0;
+
+  memset(wf->pixels, 0, blank * wf->params.width * sizeof (Uint32));
+
+  for (i = blank; i < wf->params.height; ++i) {
+    pixels = wf->pixels + i * wf->params.width;
+    record = xsig_spill_get(
+        wf->spill,
+        wf->view_end - wf->params.height + i);
+
+    if (record == NULL)
+      memset(pixels, 0, wf->params.width * sizeof (Uint32));
+    else
+      xsig_waterfall_colorize(
+          wf,
+          xsig_spill_samples(record),
+          record->offset,
+          record->scale,
+          pixels);
+  }
+
+  blit(
+      disp,
+      wf->params.x + 1,
+      wf->params.y + 1,
+      wf->params.width,
+      wf->params.height,
+      wf->pixels,
+      wf->params.width);
 }
 
-void
-xsig_waterfall_redraw(const xsig_waterfall_t *wf, display_t *disp)
+/* The blits never touch the frame, so it is drawn only when it changes */
+SUPRIVATE void
+xsig_waterfall_draw_frame(xsig_waterfall_t *wf, display_t *disp, Uint32 color)
 {
-  unsigned int i, j;
-  unsigned int row;
-  unsigned int halfsize;
-  halfsize = wf->params.fft_size / 2;
+  if (wf->frame == color)
+    return;
 
   box(
       disp,
@@ -136,19 +603,56 @@ xsig_waterfall_redraw(const xsig_waterfall_t *wf, display_t *disp)
       wf->params.y,
       wf->params.x + wf->params.width  + 1,
       wf->params.y + wf->params.height + 1,
-      OPAQUE(0x7f7f7f));
+      color);
 
-  /* TODO: Adjust FFT index to width */
-  for (j = 0; j < wf->params.height; ++j) {
-    row = (j + wf->ptr) % wf->params.height;
-    for (i = 0; i < wf->params.width; ++i)
-      pset_abs(
-          disp,
-          i + wf->params.x + 1,
-          j + wf->params.y + 1,
-          OPAQUE(calc_color_wf(
-              wf->k * wf->history[row][(i + halfsize)
-                                       % wf->params.fft_size])));
-  }
+  wf->frame = color;
 }
 
+/*
+ * Only rows fed since the last redraw are colorized (with the gain
+ * of the moment). The ring is then copied to the screen starting from
+ * the oldest row, as two blits.
+ */
+void
+xsig_waterfall_redraw(xsig_waterfall_t *wf, display_t *disp)
+{
+  unsigned int n;
+  unsigned int older = wf->params.height - wf->ptr;
+
+  xsig_waterfall_draw_frame(
+      wf,
+      disp,
+      wf->scrollback ? OPAQUE(0xbfbf3f) : OPAQUE(0x7f7f7f));
+
+  if (wf->scrollback) {
+    xsig_waterfall_redraw_scrollback(wf, disp);
+    return;
+  }
+
+  n = (wf->ptr + wf->params.height - wf->pending) % wf->params.height;
+
+  for (; wf->pending > 0; --wf->pending) {
+    xsig_waterfall_colorize_row(wf, n);
+
+    if (++n == wf->params.height)
+      n = 0;
+  }
+
+  blit(
+      disp,
+      wf->params.x + 1,
+      wf->params.y + 1,
+      wf->params.width,
+      older,
+      wf->pixels + wf->ptr * wf->params.width,
+      wf->params.width);
+
+  blit(
+      disp,
+      wf->params.x + 1,
+      wf->params.y + 1 + older,
+      wf->params.width,
+      wf->ptr,
+      wf->pixels,
+      wf->params.width);
+}
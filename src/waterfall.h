@@ -21,7 +21,18 @@
 #ifndef _WATERFALL_H
 #define _WATERFALL_H
 
+#include <stdint.h>
 #include <sigutils/sigutils.h>
+#include "noisefloor.h"
+#include "spill.h"
+
+#define XSIG_WATERFALL_ALIGN 64 /* Cache line size, in bytes */
+#define XSIG_WATERFALL_MIN_MAG 1e-20 /* Magnitudes are clipped here */
+
+enum xsig_waterfall_reduce {
+  XSIG_WATERFALL_REDUCE_MEAN, /* Average of the frames in a row */
+  XSIG_WATERFALL_REDUCE_MAX   /* Peak hold, keeps short bursts visible */
+};
 
 struct xsig_waterfall_params {
   unsigned int fft_size;
@@ -29,20 +40,63 @@ struct xsig_waterfall_params {
   unsigned int height;
   unsigned int x;
   unsigned int y;
+  unsigned int depth; /* Bits per history cell, 8 or 16 */
+  SUFLOAT range;      /* Displayed dynamic range, in dB */
+  SUFLOAT samp_rate;  /* Sample rate of the FFT frames */
+  SUFLOAT row_rate;   /* Rows per second, 0 for one row per frame */
+  enum xsig_waterfall_reduce reduce; /* How frames are merged into a row */
 };
 
 struct xsig_waterfall {
   struct xsig_waterfall_params params;
-  SUFLOAT **history;
-  unsigned int ptr;
+  /*
+   * History cells hold log-magnitudes quantized to `depth' bits. Each
+   * row has its own dB offset and scale: dB = offset + q * scale.
+   */
+  uint8_t *history;    /* height rows of `stride' bytes, ring buffer */
+  unsigned int stride; /* Row stride, in bytes */
+  SUFLOAT *offset;     /* Per-row dB of level 0 */
+  SUFLOAT *scale;      /* Per-row dB per level */
+  SUFLOAT *scratch;    /* Row being fed, before quantization */
+  SUFLOAT *acc;        /* Frames reduced into the next row */
+  unsigned int frames_per_row;
+  unsigned int frames; /* Frames in acc */
+  unsigned int ptr;    /* Next row to be written (oldest row) */
+  Uint32 *pixels;      /* Colorized history, same ring layout, width wide */
+  unsigned int pending; /* Rows fed but not colorized yet */
+  const struct colormap *cmap;
   SUFLOAT k; /* dynamic atenuation */
+  const xsig_noise_floor_t *floor; /* optional gain reference */
+  xsig_spill_t *spill; /* optional on-disk copy of every row */
+  Uint32 frame;        /* Color of the frame on screen, 0 if none */
+  SUBOOL scrollback;   /* Showing rows from the spill file */
+  uint64_t view_end;   /* Spill row after the newest one shown */
 };
 
 typedef struct xsig_waterfall xsig_waterfall_t;
 
+static inline void *
+xsig_waterfall_row(const xsig_waterfall_t *wf, unsigned int row)
+{
+  return wf->history + row * wf->stride;
+}
+
 void xsig_waterfall_destroy(xsig_waterfall_t *wf);
 xsig_waterfall_t *xsig_waterfall_new(const struct xsig_waterfall_params *params);
+void xsig_waterfall_set_noise_floor(
+    xsig_waterfall_t *wf,
+    const xsig_noise_floor_t *floor);
+void xsig_waterfall_set_colormap(
+    xsig_waterfall_t *wf,
+    const struct colormap *cmap);
+void xsig_waterfall_set_row_rate(xsig_waterfall_t *wf, SUFLOAT row_rate);
+void xsig_waterfall_set_spill(xsig_waterfall_t *wf, xsig_spill_t *spill);
+void xsig_waterfall_scroll(xsig_waterfall_t *wf, int64_t rows);
+void xsig_waterfall_scroll_to_time(xsig_waterfall_t *wf, double time);
+void xsig_waterfall_live(xsig_waterfall_t *wf);
+SUBOOL xsig_waterfall_set_height(xsig_waterfall_t *wf, unsigned int height);
+void xsig_waterfall_push(xsig_waterfall_t *wf, const SUFLOAT *row);
 void xsig_waterfall_feed(xsig_waterfall_t *wf, const SUCOMPLEX *fft);
-void xsig_waterfall_redraw(const xsig_waterfall_t *wf, display_t *disp);
+void xsig_waterfall_redraw(xsig_waterfall_t *wf, display_t *disp);
 
 #endif /* _WATERFALL_H */
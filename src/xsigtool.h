@@ -11,6 +11,7 @@
 #include <wbmp.h> /* From sim-static: Built-in simulation library over SDL */
 #include <draw.h> /* From sim-static: Built-in simulation library over SDL */
 #include <cpi.h> /* From sim-static: Built-in simulation library over SDL */
+#include <colormap.h> /* From sim-static: Built-in simulation library over SDL */
 #include <ega9.h> /* From sim-static: Built-in simulation library over SDL */
 #include <hook.h> /* From sim-static: Built-in simulation library over SDL */
 #include <layout.h> /* From sim-static: Built-in simulation library over SDL */
@@ -21,6 +22,7 @@
 
 #define XSIG_SOURCE_FFTW_PREFIX fftw
 #define XSIG_SNDFILE_READ sf_read_double
+#define XSIG_SNDFILE_READF sf_readf_double
 #define XSIG_FFTW(method) JOIN(XSIG_SOURCE_FFTW_PREFIX, method)
 
 #endif /* _MAIN_INCLUDE_H */